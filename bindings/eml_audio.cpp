@@ -33,24 +33,27 @@ rfft_py(py::array_t<float, py::array::c_style | py::array::forcecast> in) {
 
     // Setup working buffers
     const float * in_data = (const float *)in.data();
-    std::vector<float> imag(n_fft);
+    std::vector<float> imag(1+n_fft/2);
     std::vector<float> real(n_fft);
     for (size_t i=0; i<real.size(); i++) {
         real[i] = in_data[i];
     }
-    std::fill(imag.begin(), imag.end(), 0);
 
     // Do FFT
-    const int status = eml_fft_forward(fft, real.data(), imag.data(), n_fft);
+    const int status = eml_fft_rfft(fft, real.data(), imag.data(), n_fft);
 
     if (status != EmlOk) {
         throw std::runtime_error("eml_fft error");
     }
 
-    // Copy to output
+    // Copy to output. Real part is symmetric, X[n-k] = conj(X[k])
     auto ret = py::array_t<float>(n_fft);
-    for (size_t i=0; i<real.size(); i++) {
-        ((float *)ret.data())[i] = real[i];
+    float *out = (float *)ret.data();
+    for (int i=0; i<=n_fft/2; i++) {
+        out[i] = real[i];
+    }
+    for (int i=n_fft/2+1; i<n_fft; i++) {
+        out[i] = real[n_fft-i];
     }
 
     return ret;
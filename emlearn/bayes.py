@@ -24,11 +24,48 @@ def c_struct_init(vals, convert):
     s = ','.join(convert(v) for v in vals)
     return '{ ' + s + ' }'
 
+# Largest value representable by eml_q16_t
+Q16_MAX = 32767.0
+
 def c_tofixed(v):
     return "EML_Q16_FROMFLOAT({})".format(v)
 
 
-def generate_c(model, name='myclassifier'):
+def generate_trainer(class_counts, means, variances, var_epsilon, name='myclassifier'):
+    """Generate code for EmlBayesTrainer, starting from offline statistics
+
+    variances should not include var_epsilon
+    """
+    n_classes, n_features = means.shape
+    m2 = variances * class_counts[:, numpy.newaxis]
+
+    arrays = [
+        cgen.array_declare(name+'_counts', values=class_counts.astype(int), dtype='uint32_t', modifiers='static'),
+        cgen.array_declare(name+'_means', values=means.flatten(), modifiers='static'),
+        cgen.array_declare(name+'_m2', values=m2.flatten(), modifiers='static'),
+        cgen.array_declare(name+'_stale', size=n_classes, dtype='uint8_t', modifiers='static'),
+    ]
+    trainer = cgen.struct_declare(name+'_trainer', 'EmlBayesTrainer', modifiers='static',
+        values=[ n_classes, n_features, name+'_counts', name+'_means', name+'_m2', name+'_stale',
+            cgen.constant(var_epsilon) ])
+
+    functions = f"""
+    int32_t
+    {name}_train(const float *features, int32_t n_features, int32_t label)
+    {{
+        return eml_bayes_trainer_add(&{name}_trainer, features, n_features, label);
+    }}
+    """
+
+    return '\n'.join(arrays + [trainer, functions])
+
+
+def generate_c(model, name='myclassifier', trainer=None):
+    """Generate code for EmlBayesModel
+
+    If trainer is given, as (class_counts, means, variances, var_epsilon),
+    also generate an EmlBayesTrainer and a {name}_train() function for on-device training
+    """
     n_classes, n_features, n_attributes = model.shape
     assert n_attributes == 3 # mean+std+stdlog2 
 
@@ -37,7 +74,13 @@ def generate_c(model, name='myclassifier'):
     summaries_data = []
     for class_n, class_summaries in enumerate(model):
         for feature_n, summary in enumerate(class_summaries):
-            summaries_data.append(list(summary))
+            mean, std, stdlog2 = summary
+            # smallest std where the precomputed 1/std fits in Q16, like eml_bayes_trainer_refresh()
+            if std < 1.0/Q16_MAX:
+                std = 1.0/Q16_MAX
+                stdlog2 = numpy.log2(std)
+            # precomputed 1/std, avoids division during inference
+            summaries_data.append([ mean, std, stdlog2, 1.0/std ])
 
     summaries_name = name + '_summaries'
     summaries = """EmlBayesSummary {name}[{items}] = {{
@@ -66,25 +109,77 @@ def generate_c(model, name='myclassifier'):
     #include <eml_bayes.h>
     """
 
+    parts = [head, summaries, model]
+    if trainer is None:
+        predict = f'eml_bayes_predict(&{name}_model, features, n_features)'
+    else:
+        parts.append(generate_trainer(*trainer, name=name))
+        predict = f'eml_bayes_trainer_predict(&{name}_trainer, &{name}_model, features, n_features)'
+
     predict_function = f"""
     int32_t
     {name}_predict(const float *features, int32_t n_features)
     {{
-        return eml_bayes_predict(&{name}_model, features, n_features);
+        return {predict};
 
     }}
     """
 
-    return '\n\n'.join([head, summaries, model, predict_function]) 
+    return '\n\n'.join(parts + [predict_function])
+
+
+def generate_c_float(means, variances, log_priors, name='myclassifier', modifiers='static const'):
+    """Generate code for EmlBayesFloatModel
+
+    Values are stored feature-major, with all classes of a feature contiguous
+    """
+    n_classes, n_features = means.shape
+    assert variances.shape == means.shape
+    assert log_priors.shape == (n_classes,)
+
+    cgen.assert_valid_identifier(name)
+
+    stds = numpy.sqrt(variances)
+    log_norms = log_priors - numpy.sum(numpy.log(stds), axis=1) - 0.5 * n_features * numpy.log(2 * numpy.pi)
+
+    means_name = name + '_means'
+    inv_stds_name = name + '_inv_stds'
+    log_norms_name = name + '_log_norms'
+    arrays = [
+        cgen.array_declare(means_name, values=means.T.flatten(), modifiers=modifiers),
+        cgen.array_declare(inv_stds_name, values=(1.0/stds).T.flatten(), modifiers=modifiers),
+        cgen.array_declare(log_norms_name, values=log_norms, modifiers=modifiers),
+    ]
+
+    model = cgen.struct_declare(name+'_model', 'EmlBayesFloatModel',
+        values=[ n_classes, n_features, means_name, inv_stds_name, log_norms_name ])
+
+    head = """// !!! This file is generated by emlearn !!!
+
+    #include <eml_bayes.h>
+    """
+
+    predict_function = f"""
+    int32_t
+    {name}_predict(const float *features, int32_t n_features)
+    {{
+        return eml_bayes_float_predict(&{name}_model, features, n_features);
+    }}
+    """
+
+    return '\n\n'.join([head] + arrays + [model, predict_function])
 
 
 # TODO: support class_priors_
-# TODO: support predict_log_proba / predict_proba
 class Wrapper(object):
     """
     Python API for Bayes classifier implemented in C
     """
-    def __init__(self, estimator, method):
+    def __init__(self, estimator, method, dtype='q16'):
+
+        if dtype not in ('float', 'q16'):
+            raise ValueError(f"Unsupported dtype '{dtype}'. Supported: float, q16")
+        self.dtype = dtype
 
         # FIXME: use var,mean numpy arrays directly
         n_classes, n_features = estimator.theta_.shape
@@ -106,11 +201,21 @@ class Wrapper(object):
                 model[class_n,feature_n] = (mean, std, std_log2)
         self.model = model
 
+        self.means = estimator.theta_.copy()
+        self.variances = numpy.array(variance)
+        self.log_priors = numpy.log(estimator.class_prior_)
+        # for continuing training on-device
+        self.class_counts = numpy.array(estimator.class_count_)
+        self.var_epsilon = estimator.epsilon_
+
         if method == 'loadable':
             name = 'mybayes'
-            func = 'eml_bayes_predict(&{}_model, values, length)'.format(name)
+            prefix = 'eml_bayes_float' if dtype == 'float' else 'eml_bayes'
+            func = '{}_predict(&{}_model, values, length)'.format(prefix, name)
+            proba_func = '{}_predict_proba_batch(&{}_model, values, 1, length, outputs, N_CLASSES)'.format(prefix, name)
             code = self.save(name=name)
-            self.classifier = common.CompiledClassifier(code, name=name, call=func)
+            self.classifier = common.CompiledClassifier(code, name=name, call=func,
+                proba_call=proba_func, n_classes=n_classes)
         elif method == 'inline':
             raise NotImplementedError('NaiveBayes does not support inline C code generation')
         else:
@@ -120,14 +225,31 @@ class Wrapper(object):
     def predict(self, X):
         return self.classifier.predict(X)
 
-    def save(self, file=None, name=None):
+    def predict_proba(self, X):
+        return self.classifier.predict_proba(X)
+
+    def save(self, file=None, name=None, trainer=False):
+        """Generate C code for the model
+
+        With trainer=True, also generate {name}_train() for on-device training. Only for dtype q16
+        """
         if name is None:
             if file is None:
                 raise ValueError('Either name or file must be provided')
             else:
                 name = os.path.splitext(os.path.basename(file))[0]
 
-        code = generate_c(self.model, name)
+        if trainer and self.dtype != 'q16':
+            raise ValueError('On-device training is only supported for dtype q16')
+
+        if self.dtype == 'float':
+            code = generate_c_float(self.means, self.variances, self.log_priors, name=name)
+        else:
+            statistics = None
+            if trainer:
+                statistics = (self.class_counts, self.means,
+                    self.variances - self.var_epsilon, self.var_epsilon)
+            code = generate_c(self.model, name, trainer=statistics)
         if file:
             with open(file, 'w') as f:
                 f.write(code)
@@ -194,7 +194,8 @@ class CompiledClassifier():
 def compile_executable(code_file : str,
                     out_dir : str,
                     name : str ='main',
-                    include_dirs=[]):
+                    include_dirs=[],
+                    extra_compile_args=[]):
     """
     Compile C code on the host.
 
@@ -206,6 +207,7 @@ def compile_executable(code_file : str,
     :param out_dir: Path to directory where output executable will be located
     :param name: Base name of the executable
     :param include_dirs: Include directories for C headers   
+    :param extra_compile_args: Additional arguments for the compiler, like optimization flags
 
     :return: Path to executable
     """
@@ -223,9 +225,17 @@ def compile_executable(code_file : str,
         libraries = ["m"] # math library / libm
         cc_args = ["-std=c99"]
 
+    if extra_compile_args:
+        cc_args = (cc_args or []) + list(extra_compile_args)
+
+    # object files go in out_dir. Create the directory here,
+    # since distutils caches which directories it has already made
+    for obj in cc.object_filenames([code_file], output_dir=out_dir):
+        os.makedirs(os.path.dirname(obj), exist_ok=True)
 
     objects = cc.compile(
         sources=[code_file],
+        output_dir=out_dir,
         extra_preargs=cc_args,
         include_dirs=include_dirs
     )
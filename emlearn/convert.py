@@ -77,11 +77,15 @@ def convert(estimator,
         return mixture.Wrapper(estimator, method, dtype=dtype)
     elif kind in ('MLPClassifier', 'MLPRegressor'):
         return net.convert_sklearn_mlp(estimator, method, return_type=return_type, **kwargs)
+    elif kind == 'Pipeline':
+        return net.convert_sklearn_pipeline(estimator, method, return_type=return_type, **kwargs)
     elif kind == 'Sequential':
         return net.convert_keras(estimator, method, return_type=return_type, **kwargs)
     elif kind == 'GaussianNB':
-        return bayes.Wrapper(estimator, method)
+        if dtype is None:
+            dtype = 'q16'
+        return bayes.Wrapper(estimator, method, dtype=dtype)
     elif kind in ['KNeighborsClassifier']:
-        return neighbors.convert_sklearn(estimator, inference=method)
+        return neighbors.convert_sklearn(estimator, inference=method, **kwargs)
     else:
         raise ValueError("Unknown model type: '{}'".format(kind))
@@ -33,6 +33,22 @@ eml_audio_power_spectrogram(EmlVector rfft, EmlVector out, int n_fft) {
     return EmlOk;
 }
 
+/**
+\brief Compute power spectrum from the complex output of eml_fft_rfft(), normalized by FFT length
+
+Can be done in-place, with out equal to imag
+*/
+EmlError
+eml_audio_power_spectrum(const float *real, const float *imag, float *out, int n_fft) {
+    const int spec_length = 1+n_fft/2;
+
+    const float scale = 1.0f/n_fft;
+    for (int i=0; i<spec_length; i++) {
+        out[i] = scale * ((real[i]*real[i]) + (imag[i]*imag[i]));
+    }
+    return EmlOk;
+}
+
 // Simple formula, from Hidden Markov Toolkit
 // in librosa have to use htk=True to match
 float
@@ -144,7 +160,7 @@ Will perform windowing (Hann), followed by FFT and then Mel-filterbank reduction
 \param mel_params The mel-filterbank parameters to use
 \param fft FFT instance to use. Must already be initialized
 \param inout Input audio. Will be filled with
-\param temp A temporary buffer
+\param temp A temporary buffer. Must have space for 1+n_fft/2 values
 
 \return EmlOk on success, or error on failure
 */
@@ -158,12 +174,14 @@ eml_audio_melspectrogram(EmlAudioMel mel_params, EmlFFT fft, EmlVector inout, Em
     // Apply window
     EML_CHECK_ERROR(eml_signal_hann_apply(inout.data, inout.length));
 
-    // Perform (short-time) FFT
-    EML_CHECK_ERROR(eml_vector_set_value(temp, 0.0f));
-    EML_CHECK_ERROR(eml_fft_forward(fft, inout.data, temp.data, inout.length));
+    EML_PRECONDITION(inout.length == n_fft, EmlSizeMismatch);
+    EML_PRECONDITION(temp.length >= s_length, EmlSizeMismatch);
+
+    // Perform (short-time) FFT. Real part in inout, imaginary part in temp
+    EML_CHECK_ERROR(eml_fft_rfft(fft, inout.data, temp.data, inout.length));
 
     // Compute mel-spectrogram
-    EML_CHECK_ERROR(eml_audio_power_spectrogram(inout, eml_vector_view(temp, 0, s_length), n_fft));
+    EML_CHECK_ERROR(eml_audio_power_spectrum(inout.data, temp.data, temp.data, n_fft));
     EML_CHECK_ERROR(eml_audio_melspec(mel_params, temp, eml_vector_view(inout, 0, n_mels)));
 
     return EmlOk;
@@ -8,14 +8,47 @@ extern "C" {
 #include "eml_common.h"
 #include "eml_fixedpoint.h"
 
+#include <math.h>
+
 #ifndef EML_MAX_CLASSES
 #define EML_MAX_CLASSES 10
 #endif
 
+// Largest standardized distance |x-mean|/std used by the Q16 model.
+// Values further away all get the log-likelihood at this distance
+#ifndef EML_BAYES_MAX_Z
+#define EML_BAYES_MAX_Z 64
+#endif
+
+// Number of rows processed together by the batch functions
+#ifndef EML_BAYES_BATCH_ROWS
+#define EML_BAYES_BATCH_ROWS 32
+#endif
+
+// Number of classes accumulated together by eml_bayes_log_likelihood_batch()
+// Uses EML_BAYES_BATCH_ROWS * EML_BAYES_BATCH_CLASSES Q16 values on the stack
+#ifndef EML_BAYES_BATCH_CLASSES
+#define EML_BAYES_BATCH_CLASSES 4
+#endif
+
+// Use AVX/NEON kernels for the float model when the compiler targets them
+#ifndef EML_BAYES_SIMD
+#define EML_BAYES_SIMD 1
+#endif
+
+#if EML_BAYES_SIMD && defined(__AVX__)
+#include <immintrin.h>
+#define EML_BAYES_AVX 1
+#elif EML_BAYES_SIMD && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define EML_BAYES_NEON 1
+#endif
+
 typedef struct _EmlBayesSummary {
     eml_q16_t mean;
     eml_q16_t std;
     eml_q16_t stdlog2;
+    eml_q16_t inv_std; // 1/std. When 0, std is divided by instead
 } EmlBayesSummary;
 
 /** @typedef EmlBayesModel
@@ -71,7 +104,7 @@ int32_t eml_bayes_log2fix (uint32_t x, size_t precision)
 }
 
 // log2 of normpdf, implemented using quadratic function
-static eml_q16_t
+static inline eml_q16_t
 eml_bayes_logpdf_std(eml_q16_t x)
 {
     const eml_q16_t a = EML_Q16_FROMFLOAT(-0.7213475204444817);
@@ -86,7 +119,7 @@ eml_bayes_logpdf_std(eml_q16_t x)
 
 // log2 of normal probability density function PDF
 // using a scaled/translated standard distribution
-static eml_q16_t
+static inline eml_q16_t
 eml_bayes_logpdf(eml_q16_t x, eml_q16_t mean, eml_q16_t std, eml_q16_t stdlog2)
 {
    const eml_q16_t xm = eml_q16_div((x - mean), std);
@@ -95,6 +128,19 @@ eml_bayes_logpdf(eml_q16_t x, eml_q16_t mean, eml_q16_t std, eml_q16_t stdlog2)
    return p; 
 }
 
+// Same as eml_bayes_logpdf(), but multiplies with a precomputed 1/std instead of dividing
+// The standardized distance is limited to EML_BAYES_MAX_Z, so that x*x in eml_bayes_logpdf_std() cannot overflow.
+// With a small std, like for a feature that is constant within a class, it can otherwise be very large
+static inline eml_q16_t
+eml_bayes_logpdf_inv(eml_q16_t x, eml_q16_t mean, eml_q16_t inv_std, eml_q16_t stdlog2)
+{
+   const int64_t xm = ((int64_t)(x - mean) * (int64_t)inv_std) >> EML_Q16_FRACT_BITS;
+   const int64_t xa = (xm > 0) ? xm : -xm;
+   const eml_q16_t xx = (xa < EML_Q16_FROMFLOAT(EML_BAYES_MAX_Z)) ? (eml_q16_t)xa : EML_Q16_FROMFLOAT(EML_BAYES_MAX_Z);
+   const eml_q16_t p = eml_bayes_logpdf_std(xx) - stdlog2;
+   return p; 
+}
+
 /**
 * \brief Make prediction and return most-probable class
 *
@@ -113,21 +159,26 @@ eml_bayes_predict(EmlBayesModel *model, const float values[], int32_t values_len
    EML_PRECONDITION(values, -EmlUninitialized);
    EML_PRECONDITION(model->n_classes >= 2, -EmlUninitialized);
 
-   eml_q16_t class_probabilities[EML_MAX_CLASSES];
+   EML_PRECONDITION(model->n_classes <= EML_MAX_CLASSES, -EmlUnsupported);
 
+   eml_q16_t class_probabilities[EML_MAX_CLASSES];
    for (int class_idx = 0; class_idx<model->n_classes; class_idx++) {
+      class_probabilities[class_idx] = 0;
+   }
 
-      eml_q16_t class_p = 0;
-      for (int value_idx = 0; value_idx<values_length; value_idx++) {
+   // Each input value is converted once, and used for all classes
+   for (int value_idx = 0; value_idx<values_length; value_idx++) {
+      const eml_q16_t val = EML_Q16_FROMFLOAT(values[value_idx]);
+
+      for (int class_idx = 0; class_idx<model->n_classes; class_idx++) {
          const int32_t summary_idx = class_idx*model->n_features + value_idx;
-         EmlBayesSummary summary = model->summaries[summary_idx];
-         const eml_q16_t val = EML_Q16_FROMFLOAT(values[value_idx]);
-         const eml_q16_t plog = eml_bayes_logpdf(val, summary.mean, summary.std, summary.stdlog2);
+         const EmlBayesSummary summary = model->summaries[summary_idx];
+         const eml_q16_t plog = (summary.inv_std) ? \
+            eml_bayes_logpdf_inv(val, summary.mean, summary.inv_std, summary.stdlog2) :
+            eml_bayes_logpdf(val, summary.mean, summary.std, summary.stdlog2);
 
-         class_p += plog;
+         class_probabilities[class_idx] += plog;
       }
-      class_probabilities[class_idx] = class_p;
-      //printf("class %d : %f\n", class_idx, p);
    }
 
    eml_q16_t highest_prob = class_probabilities[0];
@@ -142,6 +193,437 @@ eml_bayes_predict(EmlBayesModel *model, const float values[], int32_t values_len
    return highest_idx;
 }
 
+// Convert rows of log-likelihoods into normalized probabilities, in-place
+static inline void
+eml_bayes_normalize_log_proba(float *rows, int32_t n_rows, int32_t n_classes)
+{
+   for (int r=0; r<n_rows; r++) {
+      float *row = rows + (r*n_classes);
+      float max = row[0];
+      for (int c=1; c<n_classes; c++) {
+         max = (row[c] > max) ? row[c] : max;
+      }
+      float sum = 0.0f;
+      for (int c=0; c<n_classes; c++) {
+         row[c] = expf(row[c] - max);
+         sum += row[c];
+      }
+      for (int c=0; c<n_classes; c++) {
+         row[c] /= sum;
+      }
+   }
+}
+
+/**
+* \brief Compute the log-likelihood of each class, for many rows of input data
+*
+* The log2 scores of eml_bayes_predict(), converted to natural logarithm.
+* Processes the rows feature by feature, in blocks of EML_BAYES_BATCH_ROWS rows
+* and EML_BAYES_BATCH_CLASSES classes, accumulating in Q16 like eml_bayes_predict().
+* Any number of classes is supported.
+*
+* \param model EmlBayesModel instance
+* \param values Input data (n_rows * values_length)
+* \param n_rows Number of rows
+* \param values_length Length of each row. Must equal n_features
+* \param out Array to return the log-likelihoods in (n_rows * n_classes)
+* \param out_length Length of out. Must be at least n_rows * n_classes
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+int32_t
+eml_bayes_log_likelihood_batch(const EmlBayesModel *model,
+        const float values[], int32_t n_rows, int32_t values_length,
+        float *out, int32_t out_length)
+{
+   EML_PRECONDITION(model, -EmlUninitialized);
+   EML_PRECONDITION(values, -EmlUninitialized);
+   EML_PRECONDITION(values_length == model->n_features, -EmlSizeMismatch);
+   EML_PRECONDITION(out_length >= n_rows * model->n_classes, -EmlSizeMismatch);
+
+   const int n_classes = model->n_classes;
+   const int n_features = model->n_features;
+   const float log2_to_ln = 0.6931471805599453f;
+
+   for (int start=0; start<n_rows; start+=EML_BAYES_BATCH_ROWS) {
+      const int end = (start+EML_BAYES_BATCH_ROWS < n_rows) ? start+EML_BAYES_BATCH_ROWS : n_rows;
+
+      for (int first=0; first<n_classes; first+=EML_BAYES_BATCH_CLASSES) {
+         const int last = (first+EML_BAYES_BATCH_CLASSES < n_classes) ? first+EML_BAYES_BATCH_CLASSES : n_classes;
+
+         eml_q16_t acc[EML_BAYES_BATCH_ROWS*EML_BAYES_BATCH_CLASSES];
+         for (int i=0; i<EML_BAYES_BATCH_ROWS*EML_BAYES_BATCH_CLASSES; i++) {
+            acc[i] = 0;
+         }
+         for (int f=0; f<n_features; f++) {
+            for (int r=start; r<end; r++) {
+               const eml_q16_t val = EML_Q16_FROMFLOAT(values[(r*n_features)+f]);
+               eml_q16_t *row = acc + ((r-start)*EML_BAYES_BATCH_CLASSES);
+               for (int c=first; c<last; c++) {
+                  const EmlBayesSummary summary = model->summaries[(c*n_features)+f];
+                  row[c-first] += (summary.inv_std) ? \
+                     eml_bayes_logpdf_inv(val, summary.mean, summary.inv_std, summary.stdlog2) :
+                     eml_bayes_logpdf(val, summary.mean, summary.std, summary.stdlog2);
+               }
+            }
+         }
+         for (int r=start; r<end; r++) {
+            for (int c=first; c<last; c++) {
+               const eml_q16_t sum = acc[((r-start)*EML_BAYES_BATCH_CLASSES)+(c-first)];
+               out[(r*n_classes)+c] = EML_Q16_TOFLOAT(sum) * log2_to_ln;
+            }
+         }
+      }
+   }
+
+   return EmlOk;
+}
+
+/**
+* \brief Compute the probability of each class, for many rows of input data
+*
+* See eml_bayes_log_likelihood_batch()
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+int32_t
+eml_bayes_predict_proba_batch(const EmlBayesModel *model,
+        const float values[], int32_t n_rows, int32_t values_length,
+        float *out, int32_t out_length)
+{
+   const int32_t status = \
+      eml_bayes_log_likelihood_batch(model, values, n_rows, values_length, out, out_length);
+   if (status != EmlOk) {
+      return status;
+   }
+   eml_bayes_normalize_log_proba(out, n_rows, model->n_classes);
+
+   return EmlOk;
+}
+
+/** @typedef EmlBayesTrainer
+* \brief Running statistics for training an EmlBayesModel on-device
+*
+* Keeps the mean and the sum of squared differences from the mean (Welford)
+* for each class and feature, updated in O(n_features) per labeled sample.
+* The summaries of a class are only recomputed when the model is queried after it got new samples.
+*
+* The arrays can be initialized with statistics from offline training, by emlearn.
+*/
+typedef struct _EmlBayesTrainer {
+   int32_t n_classes;
+   int32_t n_features;
+   uint32_t *counts; // n_classes
+   float *means; // n_classes * n_features
+   float *m2; // n_classes * n_features. Sum of squared differences from the mean
+   uint8_t *stale; // n_classes. Summaries need to be recomputed
+   float var_epsilon; // added to all variances, like var_smoothing in scikit-learn
+} EmlBayesTrainer;
+
+/**
+* \brief Clear all statistics of the trainer
+*
+* Classes without samples keep their current summaries in the model.
+*/
+void
+eml_bayes_trainer_reset(EmlBayesTrainer *trainer)
+{
+   for (int c=0; c<trainer->n_classes; c++) {
+      trainer->counts[c] = 0;
+      trainer->stale[c] = 0;
+   }
+   for (int i=0; i<trainer->n_classes*trainer->n_features; i++) {
+      trainer->means[i] = 0.0f;
+      trainer->m2[i] = 0.0f;
+   }
+}
+
+/**
+* \brief Add a labeled sample to the training statistics
+*
+* \param trainer EmlBayesTrainer instance
+* \param values Input data
+* \param values_length Length of input data. Must equal n_features
+* \param label Class of the sample
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+int32_t
+eml_bayes_trainer_add(EmlBayesTrainer *trainer,
+        const float values[], int32_t values_length, int32_t label)
+{
+   EML_PRECONDITION(trainer, -EmlUninitialized);
+   EML_PRECONDITION(values, -EmlUninitialized);
+   EML_PRECONDITION(values_length == trainer->n_features, -EmlSizeMismatch);
+   EML_PRECONDITION(label >= 0 && label < trainer->n_classes, -EmlSizeMismatch);
+
+   const uint32_t count = trainer->counts[label] + 1;
+   const float inv_count = 1.0f / count;
+   float *means = trainer->means + (label*trainer->n_features);
+   float *m2 = trainer->m2 + (label*trainer->n_features);
+
+   for (int f=0; f<values_length; f++) {
+      const float delta = values[f] - means[f];
+      means[f] += delta * inv_count;
+      m2[f] += delta * (values[f] - means[f]);
+   }
+   trainer->counts[label] = count;
+   trainer->stale[label] = 1;
+
+   return EmlOk;
+}
+
+/**
+* \brief Recompute the model summaries of classes that got new samples
+*
+* Called automatically by eml_bayes_trainer_predict()
+*
+* \param trainer EmlBayesTrainer instance
+* \param model EmlBayesModel to update. Must have the same shape as the trainer
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+int32_t
+eml_bayes_trainer_refresh(EmlBayesTrainer *trainer, EmlBayesModel *model)
+{
+   EML_PRECONDITION(trainer, -EmlUninitialized);
+   EML_PRECONDITION(model, -EmlUninitialized);
+   EML_PRECONDITION(model->n_classes == trainer->n_classes, -EmlSizeMismatch);
+   EML_PRECONDITION(model->n_features == trainer->n_features, -EmlSizeMismatch);
+
+   // smallest std where 1/std is representable in Q16
+   const float min_std = 1.0f / 32767.0f;
+
+   for (int c=0; c<trainer->n_classes; c++) {
+      if (!trainer->stale[c] || trainer->counts[c] == 0) {
+         continue;
+      }
+      const float inv_count = 1.0f / trainer->counts[c];
+      for (int f=0; f<trainer->n_features; f++) {
+         const int32_t idx = (c*trainer->n_features) + f;
+         const float var = (trainer->m2[idx] * inv_count) + trainer->var_epsilon;
+         float std = sqrtf(var);
+         std = (std > min_std) ? std : min_std;
+
+         EmlBayesSummary *summary = &model->summaries[idx];
+         summary->mean = EML_Q16_FROMFLOAT(trainer->means[idx]);
+         summary->std = EML_Q16_FROMFLOAT(std);
+         summary->stdlog2 = EML_Q16_FROMFLOAT(log2f(std));
+         summary->inv_std = EML_Q16_FROMFLOAT(1.0f / std);
+      }
+      trainer->stale[c] = 0;
+   }
+
+   return EmlOk;
+}
+
+/**
+* \brief Make prediction with a model that is trained on-device
+*
+* Refreshes the summaries of classes that got new samples, then same as eml_bayes_predict()
+*
+* \return Class index on success, or -EmlError on failure
+*/
+int32_t
+eml_bayes_trainer_predict(EmlBayesTrainer *trainer, EmlBayesModel *model,
+        const float values[], int32_t values_length)
+{
+   const int32_t status = eml_bayes_trainer_refresh(trainer, model);
+   if (status != EmlOk) {
+      return status;
+   }
+   return eml_bayes_predict(model, values, values_length);
+}
+
+/** @typedef EmlBayesFloatModel
+* \brief Model using floating point
+*
+* Faster than EmlBayesModel on hardware with a floating point unit, and follows scikit-learn exactly.
+* The per-class values of each feature are stored contiguously (feature-major),
+* so all classes are evaluated together for one input value.
+*
+* Normally the initialization code is generated by emlearn.
+*/
+typedef struct _EmlBayesFloatModel {
+   int32_t n_classes;
+   int32_t n_features;
+   const float *means; // n_features * n_classes
+   const float *inv_stds; // n_features * n_classes. 1/std
+   // n_classes. log(prior) - sum(log(std)) - 0.5*n_features*log(2*pi), for each class
+   const float *log_norms;
+} EmlBayesFloatModel;
+
+// Add the squared standardized distance of x to each class. acc[c] += ((x - means[c]) * inv_stds[c])^2
+static inline void
+eml_bayes_float_accumulate(const float *means, const float *inv_stds,
+                            float x, float *acc, int n_classes)
+{
+    int c = 0;
+#if EML_BAYES_AVX
+    const __m256 xv = _mm256_set1_ps(x);
+    for (; c+8<=n_classes; c+=8) {
+        const __m256 z = _mm256_mul_ps(_mm256_sub_ps(xv, _mm256_loadu_ps(means+c)), _mm256_loadu_ps(inv_stds+c));
+        _mm256_storeu_ps(acc+c, _mm256_add_ps(_mm256_loadu_ps(acc+c), _mm256_mul_ps(z, z)));
+    }
+#elif EML_BAYES_NEON
+    const float32x4_t xv = vdupq_n_f32(x);
+    for (; c+4<=n_classes; c+=4) {
+        const float32x4_t z = vmulq_f32(vsubq_f32(xv, vld1q_f32(means+c)), vld1q_f32(inv_stds+c));
+        vst1q_f32(acc+c, vaddq_f32(vld1q_f32(acc+c), vmulq_f32(z, z)));
+    }
+#endif
+    for (; c<n_classes; c++) {
+        const float z = (x - means[c]) * inv_stds[c];
+        acc[c] += (z*z);
+    }
+}
+
+/**
+* \brief Compute the joint log-likelihood of each class
+*
+* Same as scikit-learn GaussianNB._joint_log_likelihood()
+*
+* \param model EmlBayesFloatModel instance
+* \param values Input data
+* \param values_length Length of input data
+* \param out Array to return the log-likelihood of each class in
+* \param out_length Length of out. Must be at least n_classes
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+int32_t
+eml_bayes_float_log_likelihood(const EmlBayesFloatModel *model,
+        const float values[], int32_t values_length,
+        float *out, int32_t out_length)
+{
+   EML_PRECONDITION(model, -EmlUninitialized);
+   EML_PRECONDITION(values, -EmlUninitialized);
+   EML_PRECONDITION(values_length == model->n_features, -EmlSizeMismatch);
+   EML_PRECONDITION(out_length >= model->n_classes, -EmlSizeMismatch);
+
+   const int n_classes = model->n_classes;
+   for (int c=0; c<n_classes; c++) {
+      out[c] = 0.0f;
+   }
+   for (int f=0; f<values_length; f++) {
+      eml_bayes_float_accumulate(model->means + (f*n_classes), model->inv_stds + (f*n_classes),
+                                 values[f], out, n_classes);
+   }
+   for (int c=0; c<n_classes; c++) {
+      out[c] = model->log_norms[c] - (0.5f * out[c]);
+   }
+
+   return EmlOk;
+}
+
+/**
+* \brief Compute the joint log-likelihood of each class, for many rows of input data
+*
+* Same results as eml_bayes_float_log_likelihood() for each row.
+* Rows are processed in blocks of EML_BAYES_BATCH_ROWS, feature by feature,
+* so the values of each feature are loaded once per block instead of once per row.
+* Any number of classes is supported.
+*
+* \param model EmlBayesFloatModel instance
+* \param values Input data (n_rows * values_length)
+* \param n_rows Number of rows
+* \param values_length Length of each row. Must equal n_features
+* \param out Array to return the log-likelihoods in (n_rows * n_classes)
+* \param out_length Length of out. Must be at least n_rows * n_classes
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+int32_t
+eml_bayes_float_log_likelihood_batch(const EmlBayesFloatModel *model,
+        const float values[], int32_t n_rows, int32_t values_length,
+        float *out, int32_t out_length)
+{
+   EML_PRECONDITION(model, -EmlUninitialized);
+   EML_PRECONDITION(values, -EmlUninitialized);
+   EML_PRECONDITION(values_length == model->n_features, -EmlSizeMismatch);
+   EML_PRECONDITION(out_length >= n_rows * model->n_classes, -EmlSizeMismatch);
+
+   const int n_classes = model->n_classes;
+   const int n_features = model->n_features;
+
+   for (int start=0; start<n_rows; start+=EML_BAYES_BATCH_ROWS) {
+      const int end = (start+EML_BAYES_BATCH_ROWS < n_rows) ? start+EML_BAYES_BATCH_ROWS : n_rows;
+
+      for (int i=start*n_classes; i<end*n_classes; i++) {
+         out[i] = 0.0f;
+      }
+      for (int f=0; f<n_features; f++) {
+         const float *means = model->means + (f*n_classes);
+         const float *inv_stds = model->inv_stds + (f*n_classes);
+         for (int r=start; r<end; r++) {
+            eml_bayes_float_accumulate(means, inv_stds, values[(r*n_features)+f],
+                                       out + (r*n_classes), n_classes);
+         }
+      }
+      for (int r=start; r<end; r++) {
+         for (int c=0; c<n_classes; c++) {
+            out[(r*n_classes)+c] = model->log_norms[c] - (0.5f * out[(r*n_classes)+c]);
+         }
+      }
+   }
+
+   return EmlOk;
+}
+
+/**
+* \brief Compute the probability of each class, for many rows of input data
+*
+* Same as scikit-learn GaussianNB.predict_proba(). See eml_bayes_float_log_likelihood_batch()
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+int32_t
+eml_bayes_float_predict_proba_batch(const EmlBayesFloatModel *model,
+        const float values[], int32_t n_rows, int32_t values_length,
+        float *out, int32_t out_length)
+{
+   const int32_t status = \
+      eml_bayes_float_log_likelihood_batch(model, values, n_rows, values_length, out, out_length);
+   if (status != EmlOk) {
+      return status;
+   }
+   eml_bayes_normalize_log_proba(out, n_rows, model->n_classes);
+
+   return EmlOk;
+}
+
+/**
+* \brief Make prediction and return most-probable class
+*
+* \param model EmlBayesFloatModel instance
+* \param values Input data
+* \param values_length Length of input data
+*
+* \return Class index on success, or -EmlError on failure
+*/
+int32_t
+eml_bayes_float_predict(const EmlBayesFloatModel *model, const float values[], int32_t values_length)
+{
+   EML_PRECONDITION(model, -EmlUninitialized);
+   EML_PRECONDITION(model->n_classes >= 2, -EmlUninitialized);
+   EML_PRECONDITION(model->n_classes <= EML_MAX_CLASSES, -EmlUnsupported);
+
+   float class_probabilities[EML_MAX_CLASSES];
+   const int32_t status = \
+      eml_bayes_float_log_likelihood(model, values, values_length, class_probabilities, EML_MAX_CLASSES);
+   if (status != EmlOk) {
+      return status;
+   }
+
+   int32_t highest_idx = 0;
+   for (int class_idx = 1; class_idx<model->n_classes; class_idx++) {
+      if (class_probabilities[class_idx] > class_probabilities[highest_idx]) {
+         highest_idx = class_idx;
+      }
+   }
+   return highest_idx;
+}
+
 
 #ifdef __cplusplus
 } // extern "C"
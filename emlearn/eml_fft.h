@@ -35,6 +35,22 @@ extern "C" {
 #include <math.h>
 
 #include "eml_common.h"
+#include "eml_fixedpoint.h"
+
+// Use AVX/NEON butterflies for EmlFFTPlan when the compiler targets them
+#ifndef EML_FFT_SIMD
+#define EML_FFT_SIMD 1
+#endif
+
+#if EML_FFT_SIMD && defined(__AVX__)
+#include <immintrin.h>
+#define EML_FFT_AVX 1
+#define EML_FFT_LANES 8
+#elif EML_FFT_SIMD && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define EML_FFT_NEON 1
+#define EML_FFT_LANES 4
+#endif
 
 static size_t reverse_bits(size_t x, int n) {
 	size_t result = 0;
@@ -53,8 +69,6 @@ typedef struct _EmlFFT {
     float *cos;
 } EmlFFT;
 
-// TODO: provide an eml_fft_init() function
-
 /**
 * Precompute coefficients and fill table
 *
@@ -75,6 +89,53 @@ eml_fft_fill(EmlFFT table, size_t n) {
     return EmlOk;
 }
 
+// In-place radix-2 FFT. Uses every stride'th value of the table,
+// so that a table for a larger FFT can be shared
+static EmlError
+eml_fft_transform(EmlFFT table, size_t stride, float real[], float imag[], size_t n) {
+
+    // Compute levels = floor(log2(n))
+	int levels = 0;
+	for (size_t temp = n; temp > 1U; temp >>= 1)
+		levels++;
+
+    EML_PRECONDITION(((size_t)(1U << levels)) == n, EmlSizeMismatch);
+    EML_PRECONDITION((size_t)table.length*2 == n*stride, EmlSizeMismatch);
+
+	// Bit-reversed addressing permutation
+	for (size_t i = 0; i < n; i++) {
+		size_t j = reverse_bits(i, levels);
+		if (j > i) {
+			float temp = real[i];
+			real[i] = real[j];
+			real[j] = temp;
+			temp = imag[i];
+			imag[i] = imag[j];
+			imag[j] = temp;
+		}
+	}
+
+	// Cooley-Tukey decimation-in-time radix-2 FFT
+	for (size_t size = 2; size <= n; size *= 2) {
+		size_t halfsize = size / 2;
+		size_t tablestep = (n / size) * stride;
+		for (size_t i = 0; i < n; i += size) {
+			for (size_t j = i, k = 0; j < i + halfsize; j++, k += tablestep) {
+				size_t l = j + halfsize;
+				float tpre =  real[l] * table.cos[k] + imag[l] * table.sin[k];
+				float tpim = -real[l] * table.sin[k] + imag[l] * table.cos[k];
+				real[l] = real[j] - tpre;
+				imag[l] = imag[j] - tpim;
+				real[j] += tpre;
+				imag[j] += tpim;
+			}
+		}
+		if (size == n)  // Prevent overflow in 'size *= 2'
+			break;
+	}	
+	return EmlOk;
+}
+
 /**
 * \brief Compute the FFT
 * 
@@ -89,49 +150,1001 @@ eml_fft_fill(EmlFFT table, size_t n) {
 */
 EmlError
 eml_fft_forward(EmlFFT table, float real[], float imag[], size_t n) {
+    return eml_fft_transform(table, 1, real, imag, n);
+}
 
-    // Compute levels = floor(log2(n))
+// Post-processing for real-input FFT. Computes bins k and j=m-k from Z[k] and Z[m-k]
+// of the half-length transform. c,s are cos,sin of 2*pi*k/n
+static inline void
+eml_fft_rfft_combine(float real[], float imag[], size_t k, size_t j, float c, float s)
+{
+    const float even_real = 0.5f * (real[k] + real[j]);
+    const float even_imag = 0.5f * (imag[k] - imag[j]);
+    const float odd_real = 0.5f * (imag[k] + imag[j]);
+    const float odd_imag = -0.5f * (real[k] - real[j]);
+
+    // W^k = cos - i*sin
+    const float t_real = c * odd_real + s * odd_imag;
+    const float t_imag = c * odd_imag - s * odd_real;
+
+    real[k] = even_real + t_real;
+    imag[k] = even_imag + t_imag;
+    real[j] = even_real - t_real;
+    imag[j] = t_imag - even_imag;
+}
+
+/**
+* \brief Compute the FFT of real-valued input
+*
+* Packs the n real values into a complex FFT of length n/2,
+* followed by a post-processing step to produce the 1+n/2 non-redundant bins.
+* Around half the time and memory of eml_fft_forward() with a zeroed imaginary part.
+* The remaining bins are the complex conjugate: X[n-k] = conj(X[k]).
+*
+* \param table EmlFFT instance, filled for length n
+* \param real Input values (n). On output, the real part of bins 0...n/2
+* \param imag Output, imaginary part of bins 0...n/2. Must have space for 1+n/2 values
+* \param n Length of the input. Must be a power of 2
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_rfft(EmlFFT table, float real[], float imag[], size_t n) {
+
+    EML_PRECONDITION(n >= 2 && (n & (n-1)) == 0, EmlSizeMismatch);
+    EML_PRECONDITION((size_t)table.length == n/2, EmlSizeMismatch);
+    const size_t m = n/2;
+
+    // Even samples as real part, odd samples as imaginary part
+    for (size_t k = 0; k < m; k++) {
+        imag[k] = real[2*k+1];
+        real[k] = real[2*k];
+    }
+
+    // Half-length FFT, using every second twiddle factor
+    EML_CHECK_ERROR(eml_fft_transform(table, 2, real, imag, m));
+
+    // Separate the transforms of the even and odd samples, and combine them
+    const float z0_real = real[0];
+    const float z0_imag = imag[0];
+    real[0] = z0_real + z0_imag;
+    imag[0] = 0.0f;
+    real[m] = z0_real - z0_imag;
+    imag[m] = 0.0f;
+
+    for (size_t k = 1; k <= m/2; k++) {
+        eml_fft_rfft_combine(real, imag, k, m-k, table.cos[k], table.sin[k]);
+    }
+    return EmlOk;
+}
+
+/** @typedef EmlFFTType
+*
+* Type of input for an EmlFFTPlan
+*/
+typedef enum _EmlFFTType {
+    EmlFFTComplex = 0,
+    EmlFFTReal,
+} EmlFFTType;
+
+// Space needed for the twiddles of an EmlFFTPlan of length n.
+// Interleaved cos,sin table (3n/2), followed by the per-stage tables (at most 2n)
+#define EML_FFT_TWIDDLES_LENGTH(n) (3*(n)/2 + 2*(n))
+// Space needed for the bit-reversal swaps of an EmlFFTPlan of length n
+#define EML_FFT_SWAPS_LENGTH(n) (n)
+
+/** @typedef EmlFFTPlan
+*
+* Precomputed state for FFTs of one length. Created with eml_fft_init()
+*/
+typedef struct _EmlFFTPlan {
+    EmlFFTType type;
+    int length; // number of input values, n
+    int transform_length; // length of the complex transform. n/2 for real input
+    int levels; // log2(transform_length)
+    // cos/sin of 2*pi*i/n, interleaved, for i < 3n/4. Covers all radix-4 twiddles
+    const float *twiddles;
+    const uint16_t *swaps; // bit-reversal permutation, as pairs of indices to swap
+    int n_swaps; // number of pairs
+    // For each radix-4 stage with quarter q: w1 real,imag, w2 real,imag, w3 real,imag. Each q long
+    const float *stage_twiddles;
+} EmlFFTPlan;
+
+/**
+* \brief Initialize a plan for computing FFTs of length n
+*
+* Precomputes twiddle factors and the bit-reversal permutation,
+* so they are not recomputed for each transform.
+*
+* \param plan EmlFFTPlan to initialize
+* \param type EmlFFTComplex for eml_fft_plan_forward(), EmlFFTReal for eml_fft_plan_rfft()
+* \param n Length of the FFT. Must be a power of 2
+* \param twiddles Buffer for twiddles, with space for EML_FFT_TWIDDLES_LENGTH(n) values
+* \param twiddles_length Length of twiddles
+* \param swaps Buffer for bit-reversal swaps, with space for EML_FFT_SWAPS_LENGTH(n) values
+* \param swaps_length Length of swaps
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_init(EmlFFTPlan *plan, EmlFFTType type, size_t n,
+        float *twiddles, size_t twiddles_length,
+        uint16_t *swaps, size_t swaps_length)
+{
+    EML_PRECONDITION(plan, EmlUninitialized);
+    EML_PRECONDITION(n >= 2 && (n & (n-1)) == 0, EmlSizeMismatch);
+    EML_PRECONDITION(twiddles_length >= (size_t)EML_FFT_TWIDDLES_LENGTH(n), EmlSizeMismatch);
+    EML_PRECONDITION(swaps_length >= (size_t)EML_FFT_SWAPS_LENGTH(n), EmlSizeMismatch);
+
+    const size_t transform_length = (type == EmlFFTReal) ? n/2 : n;
+    EML_PRECONDITION(transform_length <= 65536, EmlUnsupported);
+
+    int levels = 0;
+    for (size_t temp = transform_length; temp > 1U; temp >>= 1)
+        levels++;
+
+    for (size_t i = 0; i < (3*n)/4; i++) {
+        twiddles[2*i] = (float)cos(2 * M_PI * i / n);
+        twiddles[2*i+1] = (float)sin(2 * M_PI * i / n);
+    }
+
+    // Contiguous twiddles for each radix-4 stage, so that they can be loaded with unit stride
+    float *stage_twiddles = twiddles + (3*n)/2;
+    size_t offset = 0;
+    for (size_t quarter = (levels % 2 == 1) ? 2 : 1; 4*quarter <= transform_length; quarter *= 4) {
+        const size_t tablestep = n / (4*quarter);
+        for (size_t k = 0; k < quarter; k++) {
+            for (size_t w = 1; w <= 3; w++) {
+                const size_t idx = w*k*tablestep;
+                stage_twiddles[offset + (2*(w-1))*quarter + k] = twiddles[2*idx];
+                stage_twiddles[offset + (2*(w-1)+1)*quarter + k] = twiddles[2*idx+1];
+            }
+        }
+        offset += 6*quarter;
+    }
+
+    int n_swaps = 0;
+    for (size_t i = 0; i < transform_length; i++) {
+        const size_t j = reverse_bits(i, levels);
+        if (j > i) {
+            swaps[2*n_swaps] = (uint16_t)i;
+            swaps[2*n_swaps+1] = (uint16_t)j;
+            n_swaps += 1;
+        }
+    }
+
+    plan->type = type;
+    plan->length = (int)n;
+    plan->transform_length = (int)transform_length;
+    plan->levels = levels;
+    plan->twiddles = twiddles;
+    plan->swaps = swaps;
+    plan->n_swaps = n_swaps;
+    plan->stage_twiddles = stage_twiddles;
+
+    return EmlOk;
+}
+
+// Radix-4 butterfly for one index i of a block, in-place.
+// Element e is at re[e*step], im[e*step], so both split and interleaved layouts are supported.
+// w1,w2,w3 are cos,sin of the positive angle, so multiply with the conjugate
+static inline void
+eml_fft_radix4_scalar(float *re, float *im, int step, int i, int quarter,
+        float w1r, float w1i, float w2r, float w2i, float w3r, float w3i)
+{
+    const int i0 = i*step;
+    const int i1 = (i + quarter)*step;
+    const int i2 = (i + 2*quarter)*step;
+    const int i3 = (i + 3*quarter)*step;
+
+    // Bit-reversed order: i1 holds the DFT of the 2nd, i2 of the 1st odd quarter
+    const float a0r = re[i0];
+    const float a0i = im[i0];
+    const float a1r = re[i1] * w2r + im[i1] * w2i;
+    const float a1i = im[i1] * w2r - re[i1] * w2i;
+    const float a2r = re[i2] * w1r + im[i2] * w1i;
+    const float a2i = im[i2] * w1r - re[i2] * w1i;
+    const float a3r = re[i3] * w3r + im[i3] * w3i;
+    const float a3i = im[i3] * w3r - re[i3] * w3i;
+
+    const float s01r = a0r + a1r;
+    const float s01i = a0i + a1i;
+    const float d01r = a0r - a1r;
+    const float d01i = a0i - a1i;
+    const float s23r = a2r + a3r;
+    const float s23i = a2i + a3i;
+    const float d23r = a2r - a3r;
+    const float d23i = a2i - a3i;
+
+    re[i0] = s01r + s23r;
+    im[i0] = s01i + s23i;
+    re[i2] = s01r - s23r;
+    im[i2] = s01i - s23i;
+    // (a0-a1) -/+ i*(a2-a3)
+    re[i1] = d01r + d23i;
+    im[i1] = d01i - d23r;
+    re[i3] = d01r - d23i;
+    im[i3] = d01i + d23r;
+}
+
+#if EML_FFT_AVX
+// Load 8 complex values. Interleaved data (step 2) is split into real and imaginary vectors
+static inline void
+eml_fft_load_avx(const float *re, const float *im, int step, __m256 *r, __m256 *i)
+{
+    if (step == 1) {
+        *r = _mm256_loadu_ps(re);
+        *i = _mm256_loadu_ps(im);
+    } else {
+        const __m256 a = _mm256_loadu_ps(re);
+        const __m256 b = _mm256_loadu_ps(re + 8);
+        const __m256 lo = _mm256_permute2f128_ps(a, b, 0x20);
+        const __m256 hi = _mm256_permute2f128_ps(a, b, 0x31);
+        *r = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        *i = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+    }
+}
+
+static inline void
+eml_fft_store_avx(float *re, float *im, int step, __m256 r, __m256 i)
+{
+    if (step == 1) {
+        _mm256_storeu_ps(re, r);
+        _mm256_storeu_ps(im, i);
+    } else {
+        const __m256 lo = _mm256_unpacklo_ps(r, i);
+        const __m256 hi = _mm256_unpackhi_ps(r, i);
+        _mm256_storeu_ps(re, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(re + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+}
+
+// Radix-4 butterfly on vectors, in-place. x holds real,imag of the 4 inputs, w real,imag of w1,w2,w3
+static inline void
+eml_fft_butterfly_avx(__m256 x[8], const __m256 w[6])
+{
+    const __m256 a1r = _mm256_add_ps(_mm256_mul_ps(x[2], w[2]), _mm256_mul_ps(x[3], w[3]));
+    const __m256 a1i = _mm256_sub_ps(_mm256_mul_ps(x[3], w[2]), _mm256_mul_ps(x[2], w[3]));
+    const __m256 a2r = _mm256_add_ps(_mm256_mul_ps(x[4], w[0]), _mm256_mul_ps(x[5], w[1]));
+    const __m256 a2i = _mm256_sub_ps(_mm256_mul_ps(x[5], w[0]), _mm256_mul_ps(x[4], w[1]));
+    const __m256 a3r = _mm256_add_ps(_mm256_mul_ps(x[6], w[4]), _mm256_mul_ps(x[7], w[5]));
+    const __m256 a3i = _mm256_sub_ps(_mm256_mul_ps(x[7], w[4]), _mm256_mul_ps(x[6], w[5]));
+
+    const __m256 s01r = _mm256_add_ps(x[0], a1r);
+    const __m256 s01i = _mm256_add_ps(x[1], a1i);
+    const __m256 d01r = _mm256_sub_ps(x[0], a1r);
+    const __m256 d01i = _mm256_sub_ps(x[1], a1i);
+    const __m256 s23r = _mm256_add_ps(a2r, a3r);
+    const __m256 s23i = _mm256_add_ps(a2i, a3i);
+    const __m256 d23r = _mm256_sub_ps(a2r, a3r);
+    const __m256 d23i = _mm256_sub_ps(a2i, a3i);
+
+    x[0] = _mm256_add_ps(s01r, s23r);
+    x[1] = _mm256_add_ps(s01i, s23i);
+    x[4] = _mm256_sub_ps(s01r, s23r);
+    x[5] = _mm256_sub_ps(s01i, s23i);
+    x[2] = _mm256_add_ps(d01r, d23i);
+    x[3] = _mm256_sub_ps(d01i, d23r);
+    x[6] = _mm256_sub_ps(d01r, d23i);
+    x[7] = _mm256_add_ps(d01i, d23r);
+}
+
+// Same as eml_fft_radix4_scalar(), for 8 consecutive indices. tw points to the stage twiddles at index k
+static inline void
+eml_fft_radix4_avx(float *re, float *im, int step, int i, int quarter, const float *tw)
+{
+    __m256 w[6];
+    __m256 x[8];
+    for (int p = 0; p < 6; p++) {
+        w[p] = _mm256_loadu_ps(tw + p*quarter);
+    }
+    for (int p = 0; p < 4; p++) {
+        const int e = (i + p*quarter)*step;
+        eml_fft_load_avx(re + e, im + e, step, &x[2*p], &x[2*p+1]);
+    }
+    eml_fft_butterfly_avx(x, w);
+    for (int p = 0; p < 4; p++) {
+        const int e = (i + p*quarter)*step;
+        eml_fft_store_avx(re + e, im + e, step, x[2*p], x[2*p+1]);
+    }
+}
+#endif
+
+#if EML_FFT_NEON
+// Load 4 complex values. Interleaved data (step 2) is split into real and imaginary vectors
+static inline void
+eml_fft_load_neon(const float *re, const float *im, int step, float32x4_t *r, float32x4_t *i)
+{
+    if (step == 1) {
+        *r = vld1q_f32(re);
+        *i = vld1q_f32(im);
+    } else {
+        const float32x4x2_t v = vld2q_f32(re);
+        *r = v.val[0];
+        *i = v.val[1];
+    }
+}
+
+static inline void
+eml_fft_store_neon(float *re, float *im, int step, float32x4_t r, float32x4_t i)
+{
+    if (step == 1) {
+        vst1q_f32(re, r);
+        vst1q_f32(im, i);
+    } else {
+        float32x4x2_t v;
+        v.val[0] = r;
+        v.val[1] = i;
+        vst2q_f32(re, v);
+    }
+}
+
+// Radix-4 butterfly on vectors, in-place. x holds real,imag of the 4 inputs, w real,imag of w1,w2,w3
+static inline void
+eml_fft_butterfly_neon(float32x4_t x[8], const float32x4_t w[6])
+{
+    const float32x4_t a1r = vmlaq_f32(vmulq_f32(x[2], w[2]), x[3], w[3]);
+    const float32x4_t a1i = vmlsq_f32(vmulq_f32(x[3], w[2]), x[2], w[3]);
+    const float32x4_t a2r = vmlaq_f32(vmulq_f32(x[4], w[0]), x[5], w[1]);
+    const float32x4_t a2i = vmlsq_f32(vmulq_f32(x[5], w[0]), x[4], w[1]);
+    const float32x4_t a3r = vmlaq_f32(vmulq_f32(x[6], w[4]), x[7], w[5]);
+    const float32x4_t a3i = vmlsq_f32(vmulq_f32(x[7], w[4]), x[6], w[5]);
+
+    const float32x4_t s01r = vaddq_f32(x[0], a1r);
+    const float32x4_t s01i = vaddq_f32(x[1], a1i);
+    const float32x4_t d01r = vsubq_f32(x[0], a1r);
+    const float32x4_t d01i = vsubq_f32(x[1], a1i);
+    const float32x4_t s23r = vaddq_f32(a2r, a3r);
+    const float32x4_t s23i = vaddq_f32(a2i, a3i);
+    const float32x4_t d23r = vsubq_f32(a2r, a3r);
+    const float32x4_t d23i = vsubq_f32(a2i, a3i);
+
+    x[0] = vaddq_f32(s01r, s23r);
+    x[1] = vaddq_f32(s01i, s23i);
+    x[4] = vsubq_f32(s01r, s23r);
+    x[5] = vsubq_f32(s01i, s23i);
+    x[2] = vaddq_f32(d01r, d23i);
+    x[3] = vsubq_f32(d01i, d23r);
+    x[6] = vsubq_f32(d01r, d23i);
+    x[7] = vaddq_f32(d01i, d23r);
+}
+
+// Same as eml_fft_radix4_scalar(), for 4 consecutive indices. tw points to the stage twiddles at index k
+static inline void
+eml_fft_radix4_neon(float *re, float *im, int step, int i, int quarter, const float *tw)
+{
+    float32x4_t w[6];
+    float32x4_t x[8];
+    for (int p = 0; p < 6; p++) {
+        w[p] = vld1q_f32(tw + p*quarter);
+    }
+    for (int p = 0; p < 4; p++) {
+        const int e = (i + p*quarter)*step;
+        eml_fft_load_neon(re + e, im + e, step, &x[2*p], &x[2*p+1]);
+    }
+    eml_fft_butterfly_neon(x, w);
+    for (int p = 0; p < 4; p++) {
+        const int e = (i + p*quarter)*step;
+        eml_fft_store_neon(re + e, im + e, step, x[2*p], x[2*p+1]);
+    }
+}
+#endif
+
+// In-place complex FFT of plan->transform_length.
+// Radix-4 decimation-in-time, with one radix-2 stage first when the number of levels is odd.
+// Uses 3 complex multiplies per 4 points and stage pair, instead of 4 for radix-2.
+// step is 1 for split real/imag arrays, 2 for interleaved data (im == re+1)
+static inline void
+eml_fft_plan_transform(const EmlFFTPlan *plan, float *re, float *im, int step)
+{
+    const int n = plan->transform_length;
+
+    // Bit-reversed addressing permutation
+    for (int s = 0; s < plan->n_swaps; s++) {
+        const int i = plan->swaps[2*s] * step;
+        const int j = plan->swaps[2*s+1] * step;
+        float temp = re[i];
+        re[i] = re[j];
+        re[j] = temp;
+        temp = im[i];
+        im[i] = im[j];
+        im[j] = temp;
+    }
+
+    int quarter = 1;
+    if (plan->levels % 2 == 1) {
+        // radix-2 stage of size 2, all twiddles are 1
+        for (int i = 0; i < n*step; i += 2*step) {
+            const float ar = re[i];
+            const float ai = im[i];
+            re[i] = ar + re[i+step];
+            im[i] = ai + im[i+step];
+            re[i+step] = ar - re[i+step];
+            im[i+step] = ai - im[i+step];
+        }
+        quarter = 2;
+    }
+
+    const float *tw = plan->stage_twiddles;
+    for (; 4*quarter <= n; quarter *= 4) {
+        const int size = 4*quarter;
+
+        for (int start = 0; start < n; start += size) {
+            int k = 0;
+#if EML_FFT_AVX
+            for (; k + EML_FFT_LANES <= quarter; k += EML_FFT_LANES) {
+                eml_fft_radix4_avx(re, im, step, start + k, quarter, tw + k);
+            }
+#elif EML_FFT_NEON
+            for (; k + EML_FFT_LANES <= quarter; k += EML_FFT_LANES) {
+                eml_fft_radix4_neon(re, im, step, start + k, quarter, tw + k);
+            }
+#endif
+            for (; k < quarter; k++) {
+                eml_fft_radix4_scalar(re, im, step, start + k, quarter,
+                    tw[k], tw[quarter + k],
+                    tw[2*quarter + k], tw[3*quarter + k],
+                    tw[4*quarter + k], tw[5*quarter + k]);
+            }
+        }
+        tw += 6*quarter;
+    }
+}
+
+// In-place complex FFT of n_channels channels, with sample i of channel c at re[i*stride + c].
+// Same algorithm as eml_fft_plan_transform(), with the twiddles shared by all channels.
+// The innermost loop is over channels, which are contiguous, so each SIMD lane is one channel
+static inline void
+eml_fft_plan_transform_channels(const EmlFFTPlan *plan, float *re, float *im,
+        int stride, int n_channels)
+{
+    const int n = plan->transform_length;
+
+    for (int s = 0; s < plan->n_swaps; s++) {
+        float *ri = re + (plan->swaps[2*s] * stride);
+        float *rj = re + (plan->swaps[2*s+1] * stride);
+        float *ii = im + (plan->swaps[2*s] * stride);
+        float *ij = im + (plan->swaps[2*s+1] * stride);
+        for (int c = 0; c < n_channels; c++) {
+            float temp = ri[c];
+            ri[c] = rj[c];
+            rj[c] = temp;
+            temp = ii[c];
+            ii[c] = ij[c];
+            ij[c] = temp;
+        }
+    }
+
+    int quarter = 1;
+    if (plan->levels % 2 == 1) {
+        for (int i = 0; i < n; i += 2) {
+            float *r0 = re + (i*stride);
+            float *i0 = im + (i*stride);
+            float *r1 = r0 + stride;
+            float *i1 = i0 + stride;
+            for (int c = 0; c < n_channels; c++) {
+                const float ar = r0[c];
+                const float ai = i0[c];
+                r0[c] = ar + r1[c];
+                i0[c] = ai + i1[c];
+                r1[c] = ar - r1[c];
+                i1[c] = ai - i1[c];
+            }
+        }
+        quarter = 2;
+    }
+
+    const float *tw = plan->stage_twiddles;
+    for (; 4*quarter <= n; quarter *= 4) {
+        const int size = 4*quarter;
+
+        for (int start = 0; start < n; start += size) {
+            for (int k = 0; k < quarter; k++) {
+                const int i = start + k;
+                int c = 0;
+#if EML_FFT_AVX
+                __m256 w[6];
+                for (int p = 0; p < 6; p++) {
+                    w[p] = _mm256_set1_ps(tw[p*quarter + k]);
+                }
+                for (; c + EML_FFT_LANES <= n_channels; c += EML_FFT_LANES) {
+                    __m256 x[8];
+                    for (int p = 0; p < 4; p++) {
+                        const int e = (i + p*quarter)*stride + c;
+                        x[2*p] = _mm256_loadu_ps(re + e);
+                        x[2*p+1] = _mm256_loadu_ps(im + e);
+                    }
+                    eml_fft_butterfly_avx(x, w);
+                    for (int p = 0; p < 4; p++) {
+                        const int e = (i + p*quarter)*stride + c;
+                        _mm256_storeu_ps(re + e, x[2*p]);
+                        _mm256_storeu_ps(im + e, x[2*p+1]);
+                    }
+                }
+#elif EML_FFT_NEON
+                float32x4_t w[6];
+                for (int p = 0; p < 6; p++) {
+                    w[p] = vdupq_n_f32(tw[p*quarter + k]);
+                }
+                for (; c + EML_FFT_LANES <= n_channels; c += EML_FFT_LANES) {
+                    float32x4_t x[8];
+                    for (int p = 0; p < 4; p++) {
+                        const int e = (i + p*quarter)*stride + c;
+                        x[2*p] = vld1q_f32(re + e);
+                        x[2*p+1] = vld1q_f32(im + e);
+                    }
+                    eml_fft_butterfly_neon(x, w);
+                    for (int p = 0; p < 4; p++) {
+                        const int e = (i + p*quarter)*stride + c;
+                        vst1q_f32(re + e, x[2*p]);
+                        vst1q_f32(im + e, x[2*p+1]);
+                    }
+                }
+#endif
+                for (; c < n_channels; c++) {
+                    eml_fft_radix4_scalar(re + c, im + c, stride, i, quarter,
+                        tw[k], tw[quarter + k],
+                        tw[2*quarter + k], tw[3*quarter + k],
+                        tw[4*quarter + k], tw[5*quarter + k]);
+                }
+            }
+        }
+        tw += 6*quarter;
+    }
+}
+
+/**
+* \brief Compute the FFT, using a precomputed plan
+*
+* Same result as eml_fft_forward(). Computed in-place.
+*
+* \param plan EmlFFTPlan of type EmlFFTComplex
+* \param real Real part of input/output values
+* \param imag Imaginary part of input/output values
+* \param n Length of the buffers. Must equal the plan length
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_plan_forward(const EmlFFTPlan *plan, float real[], float imag[], size_t n)
+{
+    EML_PRECONDITION(plan, EmlUninitialized);
+    EML_PRECONDITION(plan->type == EmlFFTComplex, EmlUnsupported);
+    EML_PRECONDITION((size_t)plan->length == n, EmlSizeMismatch);
+
+    eml_fft_plan_transform(plan, real, imag, 1);
+    return EmlOk;
+}
+
+/**
+* \brief Compute the FFT of interleaved complex data, using a precomputed plan
+*
+* Same result as eml_fft_plan_forward(), with values stored as real,imag pairs
+*
+* \param plan EmlFFTPlan of type EmlFFTComplex
+* \param data Input/output values, as n real,imag pairs (2*n floats)
+* \param n Number of complex values. Must equal the plan length
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_plan_forward_interleaved(const EmlFFTPlan *plan, float data[], size_t n)
+{
+    EML_PRECONDITION(plan, EmlUninitialized);
+    EML_PRECONDITION(plan->type == EmlFFTComplex, EmlUnsupported);
+    EML_PRECONDITION((size_t)plan->length == n, EmlSizeMismatch);
+
+    eml_fft_plan_transform(plan, data, data+1, 2);
+    return EmlOk;
+}
+
+/**
+* \brief Compute the FFT of real-valued input, using a precomputed plan
+*
+* Same result and buffer layout as eml_fft_rfft()
+*
+* \param plan EmlFFTPlan of type EmlFFTReal
+* \param real Input values (n). On output, the real part of bins 0...n/2
+* \param imag Output, imaginary part of bins 0...n/2. Must have space for 1+n/2 values
+* \param n Length of the input. Must equal the plan length
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_plan_rfft(const EmlFFTPlan *plan, float real[], float imag[], size_t n)
+{
+    EML_PRECONDITION(plan, EmlUninitialized);
+    EML_PRECONDITION(plan->type == EmlFFTReal, EmlUnsupported);
+    EML_PRECONDITION((size_t)plan->length == n, EmlSizeMismatch);
+    const size_t m = n/2;
+
+    for (size_t k = 0; k < m; k++) {
+        imag[k] = real[2*k+1];
+        real[k] = real[2*k];
+    }
+
+    eml_fft_plan_transform(plan, real, imag, 1);
+
+    const float z0_real = real[0];
+    const float z0_imag = imag[0];
+    real[0] = z0_real + z0_imag;
+    imag[0] = 0.0f;
+    real[m] = z0_real - z0_imag;
+    imag[m] = 0.0f;
+
+    for (size_t k = 1; k <= m/2; k++) {
+        eml_fft_rfft_combine(real, imag, k, m-k, plan->twiddles[2*k], plan->twiddles[2*k+1]);
+    }
+    return EmlOk;
+}
+
+/**
+* \brief Compute the FFT of many channels at once, using a precomputed plan
+*
+* For multi-channel data, like multi-axis accelerometers or microphone arrays.
+* Values are stored sample-major: sample i of channel c is at real[i*stride + c].
+* The channels are processed together, sharing the plan and twiddles,
+* with SIMD lanes across channels when EML_FFT_SIMD is enabled.
+* Each channel gives the same result as eml_fft_plan_forward().
+*
+* Channels are independent, so a subset can be transformed by offsetting
+* the buffers and reducing n_channels. For example to split the work over threads.
+*
+* \param plan EmlFFTPlan of type EmlFFTComplex
+* \param real Real part of input/output values (n*stride)
+* \param imag Imaginary part of input/output values (n*stride)
+* \param n Length of each channel. Must equal the plan length
+* \param stride Distance between consecutive samples of a channel. At least n_channels
+* \param n_channels Number of channels to transform
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_plan_forward_channels(const EmlFFTPlan *plan, float real[], float imag[],
+        size_t n, size_t stride, size_t n_channels)
+{
+    EML_PRECONDITION(plan, EmlUninitialized);
+    EML_PRECONDITION(plan->type == EmlFFTComplex, EmlUnsupported);
+    EML_PRECONDITION((size_t)plan->length == n, EmlSizeMismatch);
+    EML_PRECONDITION(stride >= n_channels, EmlSizeMismatch);
+
+    eml_fft_plan_transform_channels(plan, real, imag, (int)stride, (int)n_channels);
+    return EmlOk;
+}
+
+/**
+* \brief Compute the FFT of real-valued input for many channels at once, using a precomputed plan
+*
+* Same as eml_fft_plan_rfft() for each channel, with the layout of eml_fft_plan_forward_channels().
+* On output, bin k of channel c is at real[k*stride + c] and imag[k*stride + c].
+*
+* \param plan EmlFFTPlan of type EmlFFTReal
+* \param real Input values (n*stride). On output, the real part of bins 0...n/2
+* \param imag Output, imaginary part of bins 0...n/2. Must have space for (1+n/2)*stride values
+* \param n Length of each channel. Must equal the plan length
+* \param stride Distance between consecutive samples of a channel. At least n_channels
+* \param n_channels Number of channels to transform
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_plan_rfft_channels(const EmlFFTPlan *plan, float real[], float imag[],
+        size_t n, size_t stride, size_t n_channels)
+{
+    EML_PRECONDITION(plan, EmlUninitialized);
+    EML_PRECONDITION(plan->type == EmlFFTReal, EmlUnsupported);
+    EML_PRECONDITION((size_t)plan->length == n, EmlSizeMismatch);
+    EML_PRECONDITION(stride >= n_channels, EmlSizeMismatch);
+    const size_t m = n/2;
+
+    for (size_t k = 0; k < m; k++) {
+        for (size_t c = 0; c < n_channels; c++) {
+            imag[k*stride + c] = real[(2*k+1)*stride + c];
+            real[k*stride + c] = real[(2*k)*stride + c];
+        }
+    }
+
+    eml_fft_plan_transform_channels(plan, real, imag, (int)stride, (int)n_channels);
+
+    for (size_t c = 0; c < n_channels; c++) {
+        const float z0_real = real[c];
+        const float z0_imag = imag[c];
+        real[c] = z0_real + z0_imag;
+        imag[c] = 0.0f;
+        real[m*stride + c] = z0_real - z0_imag;
+        imag[m*stride + c] = 0.0f;
+    }
+    for (size_t k = 1; k <= m/2; k++) {
+        const float cos_k = plan->twiddles[2*k];
+        const float sin_k = plan->twiddles[2*k+1];
+        for (size_t c = 0; c < n_channels; c++) {
+            eml_fft_rfft_combine(real + c, imag + c, k*stride, (m-k)*stride, cos_k, sin_k);
+        }
+    }
+    return EmlOk;
+}
+
+/** @typedef EmlFFTQ15
+*
+* FFT coefficients for fixed-point Q15 FFT. Same layout as EmlFFT
+*/
+typedef struct _EmlFFTQ15 {
+    int length; // (n/2)
+    eml_q15_t *sin;
+    eml_q15_t *cos;
+} EmlFFTQ15;
+
+/** @typedef EmlFFTQ31
+*
+* FFT coefficients for fixed-point Q31 FFT. Same layout as EmlFFT
+*/
+typedef struct _EmlFFTQ31 {
+    int length; // (n/2)
+    eml_q31_t *sin;
+    eml_q31_t *cos;
+} EmlFFTQ31;
+
+/**
+* Precompute coefficients and fill table for Q15 FFT
+*
+* Uses floating point. Can also be done offline, on the host.
+*
+* \param table EmlFFTQ15 instance
+* \param n Length of the FFT operation
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_q15_fill(EmlFFTQ15 table, size_t n) {
+    EML_PRECONDITION((size_t)table.length == n/2, EmlSizeMismatch);
+
+    for (size_t i = 0; i < (size_t)(n / 2); i++) {
+        table.cos[i] = eml_q15_from_float((float)cos(2 * M_PI * i / n));
+        table.sin[i] = eml_q15_from_float((float)sin(2 * M_PI * i / n));
+    }
+    return EmlOk;
+}
+
+/**
+* Precompute coefficients and fill table for Q31 FFT
+*
+* Uses floating point. Can also be done offline, on the host.
+*
+* \param table EmlFFTQ31 instance
+* \param n Length of the FFT operation
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_q31_fill(EmlFFTQ31 table, size_t n) {
+    EML_PRECONDITION((size_t)table.length == n/2, EmlSizeMismatch);
+
+    for (size_t i = 0; i < (size_t)(n / 2); i++) {
+        table.cos[i] = eml_q31_from_float(cos(2 * M_PI * i / n));
+        table.sin[i] = eml_q31_from_float(sin(2 * M_PI * i / n));
+    }
+    return EmlOk;
+}
+
+// Arithmetic right shift with rounding
+static inline int64_t
+eml_fft_shift_round(int64_t x, int shift)
+{
+    return (shift > 0) ? ((x + (((int64_t)1) << (shift-1))) >> shift) : x;
+}
+
+// Largest of max, |a| and |b|
+static inline int64_t
+eml_fft_max_abs(int64_t max, int64_t a, int64_t b)
+{
+    a = (a < 0) ? -a : a;
+    b = (b < 0) ? -b : b;
+    max = (a > max) ? a : max;
+    return (b > max) ? b : max;
+}
+
+// Block floating point: right shift needed so that all values are below limit.
+// With max < 1/4 of full scale, a radix-2 butterfly cannot overflow (grows at most 1+sqrt(2))
+static inline int
+eml_fft_block_shift(int64_t max, int64_t limit)
+{
+    int shift = 0;
+    while ((max >> shift) >= limit) {
+        shift += 1;
+    }
+    return shift;
+}
+
+/**
+* \brief Compute the FFT in fixed-point Q15
+*
+* Radix-2, computed in-place, using only integer operations.
+* Uses block floating point: before each stage the whole block is scaled down,
+* just as much as needed to avoid overflow. This keeps the most precision for small inputs.
+* The result is the FFT of the input, scaled by 2^-exponent.
+*
+* \param table EmlFFTQ15 instance
+* \param real Real part of input/output values
+* \param imag Imaginary part of input/output values
+* \param n Length of the buffers. Must be a power of 2
+* \param exponent Output. Number of bits the result was scaled down with
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_q15_forward(EmlFFTQ15 table, eml_q15_t real[], eml_q15_t imag[], size_t n, int *exponent)
+{
 	int levels = 0;
 	for (size_t temp = n; temp > 1U; temp >>= 1)
 		levels++;
 
     EML_PRECONDITION(((size_t)(1U << levels)) == n, EmlSizeMismatch);
     EML_PRECONDITION((size_t)table.length == n/2, EmlSizeMismatch);
+    EML_PRECONDITION(exponent, EmlUninitialized);
 
-	// Bit-reversed addressing permutation
+    int64_t max = 0;
 	for (size_t i = 0; i < n; i++) {
 		size_t j = reverse_bits(i, levels);
 		if (j > i) {
-			float temp = real[i];
+			eml_q15_t temp = real[i];
 			real[i] = real[j];
 			real[j] = temp;
 			temp = imag[i];
 			imag[i] = imag[j];
 			imag[j] = temp;
 		}
+        max = eml_fft_max_abs(max, real[i], imag[i]);
 	}
 
-	// Cooley-Tukey decimation-in-time radix-2 FFT
+    int total_shift = 0;
 	for (size_t size = 2; size <= n; size *= 2) {
-		size_t halfsize = size / 2;
-		size_t tablestep = n / size;
+        const int shift = eml_fft_block_shift(max, 1 << (EML_Q15_FRACT_BITS-2));
+        total_shift += shift;
+        max = 0;
+
+		const size_t halfsize = size / 2;
+		const size_t tablestep = n / size;
 		for (size_t i = 0; i < n; i += size) {
 			for (size_t j = i, k = 0; j < i + halfsize; j++, k += tablestep) {
-				size_t l = j + halfsize;
-				float tpre =  real[l] * table.cos[k] + imag[l] * table.sin[k];
-				float tpim = -real[l] * table.sin[k] + imag[l] * table.cos[k];
-				real[l] = real[j] - tpre;
-				imag[l] = imag[j] - tpim;
-				real[j] += tpre;
-				imag[j] += tpim;
+				const size_t l = j + halfsize;
+                const int32_t ar = (int32_t)eml_fft_shift_round(real[j], shift);
+                const int32_t ai = (int32_t)eml_fft_shift_round(imag[j], shift);
+                const int32_t br = (int32_t)eml_fft_shift_round(real[l], shift);
+                const int32_t bi = (int32_t)eml_fft_shift_round(imag[l], shift);
+                const int32_t c = table.cos[k];
+                const int32_t s = table.sin[k];
+                const int32_t round = 1 << (EML_Q15_FRACT_BITS-1);
+				const int32_t tpre = (br * c + bi * s + round) >> EML_Q15_FRACT_BITS;
+				const int32_t tpim = (bi * c - br * s + round) >> EML_Q15_FRACT_BITS;
+
+				real[l] = (eml_q15_t)(ar - tpre);
+				imag[l] = (eml_q15_t)(ai - tpim);
+				real[j] = (eml_q15_t)(ar + tpre);
+				imag[j] = (eml_q15_t)(ai + tpim);
+                max = eml_fft_max_abs(max, real[j], imag[j]);
+                max = eml_fft_max_abs(max, real[l], imag[l]);
 			}
 		}
 		if (size == n)  // Prevent overflow in 'size *= 2'
 			break;
-	}	
+	}
+
+    *exponent = total_shift;
+	return EmlOk;
+}
+
+/**
+* \brief Compute the FFT in fixed-point Q31
+*
+* Same as eml_fft_q15_forward(), with 32 bit values and 64 bit intermediates
+*
+* \param table EmlFFTQ31 instance
+* \param real Real part of input/output values
+* \param imag Imaginary part of input/output values
+* \param n Length of the buffers. Must be a power of 2
+* \param exponent Output. Number of bits the result was scaled down with
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_q31_forward(EmlFFTQ31 table, eml_q31_t real[], eml_q31_t imag[], size_t n, int *exponent)
+{
+	int levels = 0;
+	for (size_t temp = n; temp > 1U; temp >>= 1)
+		levels++;
+
+    EML_PRECONDITION(((size_t)(1U << levels)) == n, EmlSizeMismatch);
+    EML_PRECONDITION((size_t)table.length == n/2, EmlSizeMismatch);
+    EML_PRECONDITION(exponent, EmlUninitialized);
+
+    int64_t max = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t j = reverse_bits(i, levels);
+		if (j > i) {
+			eml_q31_t temp = real[i];
+			real[i] = real[j];
+			real[j] = temp;
+			temp = imag[i];
+			imag[i] = imag[j];
+			imag[j] = temp;
+		}
+        max = eml_fft_max_abs(max, real[i], imag[i]);
+	}
+
+    int total_shift = 0;
+	for (size_t size = 2; size <= n; size *= 2) {
+        const int shift = eml_fft_block_shift(max, ((int64_t)1) << (EML_Q31_FRACT_BITS-2));
+        total_shift += shift;
+        max = 0;
+
+		const size_t halfsize = size / 2;
+		const size_t tablestep = n / size;
+		for (size_t i = 0; i < n; i += size) {
+			for (size_t j = i, k = 0; j < i + halfsize; j++, k += tablestep) {
+				const size_t l = j + halfsize;
+                const int64_t ar = (int64_t)eml_fft_shift_round(real[j], shift);
+                const int64_t ai = (int64_t)eml_fft_shift_round(imag[j], shift);
+                const int64_t br = (int64_t)eml_fft_shift_round(real[l], shift);
+                const int64_t bi = (int64_t)eml_fft_shift_round(imag[l], shift);
+                const int64_t c = table.cos[k];
+                const int64_t s = table.sin[k];
+                const int64_t round = ((int64_t)1) << (EML_Q31_FRACT_BITS-1);
+				const int64_t tpre = (br * c + bi * s + round) >> EML_Q31_FRACT_BITS;
+				const int64_t tpim = (bi * c - br * s + round) >> EML_Q31_FRACT_BITS;
+
+				real[l] = (eml_q31_t)(ar - tpre);
+				imag[l] = (eml_q31_t)(ai - tpim);
+				real[j] = (eml_q31_t)(ar + tpre);
+				imag[j] = (eml_q31_t)(ai + tpim);
+                max = eml_fft_max_abs(max, real[j], imag[j]);
+                max = eml_fft_max_abs(max, real[l], imag[l]);
+			}
+		}
+		if (size == n)  // Prevent overflow in 'size *= 2'
+			break;
+	}
+
+    *exponent = total_shift;
 	return EmlOk;
 }
 
+/**
+* \brief Compute power spectrum from the output of eml_fft_q15_forward()
+*
+* out = real^2 + imag^2, in Q30. The power of the FFT is out * 2^(2*exponent)
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_q15_power(const eml_q15_t real[], const eml_q15_t imag[], uint32_t out[], size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        const int32_t re = real[i];
+        const int32_t im = imag[i];
+        out[i] = (uint32_t)(re * re) + (uint32_t)(im * im);
+    }
+    return EmlOk;
+}
+
+/**
+* \brief Compute power spectrum from the output of eml_fft_q31_forward()
+*
+* out = real^2 + imag^2, in Q30. The power of the FFT is out * 2^(2*exponent)
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_fft_q31_power(const eml_q31_t real[], const eml_q31_t imag[], uint32_t out[], size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        const int64_t re = real[i];
+        const int64_t im = imag[i];
+        const uint64_t power = (uint64_t)(re * re) + (uint64_t)(im * im);
+        out[i] = (uint32_t)(power >> 32);
+    }
+    return EmlOk;
+}
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -32,7 +32,14 @@ typedef int32_t eml_q16_t;
 // Fixed-point math
 #define eml_q16_mul(x, y) ( ((x) >> EML_Q16_FRACT_BITS/2) * ((y)>> EML_Q16_FRACT_BITS/2) )
 
-static eml_q16_t
+// Multiplication with a 64-bit intermediate. Keeps full precision for small values
+static inline eml_q16_t
+eml_q16_mul64(eml_q16_t a, eml_q16_t b)
+{
+    return (eml_q16_t)(((int64_t)a * (int64_t)b) >> EML_Q16_FRACT_BITS);
+}
+
+static inline eml_q16_t
 eml_q16_div(eml_q16_t a, eml_q16_t b)
 {
     int64_t temp = (int64_t)a << EML_Q16_FRACT_BITS;
@@ -44,6 +51,49 @@ eml_q16_div(eml_q16_t a, eml_q16_t b)
     return (int32_t)(temp / b);
 }
 
+/** @typedef eml_q15_t
+*  Signed fixed-point number in Q15 format
+*
+* Uses 16 bits storage. 1 bit for sign, and 15 bits for fraction. Range [-1.0, 1.0)
+*/
+typedef int16_t eml_q15_t;
+#define EML_Q15_FRACT_BITS 15
+#define EML_Q15_TOFLOAT(x) (((float)(x)) / (1 << EML_Q15_FRACT_BITS))
+
+/** @typedef eml_q31_t
+*  Signed fixed-point number in Q31 format
+*
+* Uses 32 bits storage. 1 bit for sign, and 31 bits for fraction. Range [-1.0, 1.0)
+*/
+typedef int32_t eml_q31_t;
+#define EML_Q31_FRACT_BITS 31
+#define EML_Q31_TOFLOAT(x) ((float)((double)(x) / 2147483648.0))
+
+// Conversion with rounding, saturating at the ends of the range
+static inline eml_q15_t
+eml_q15_from_float(float x)
+{
+    const float v = x * (1 << EML_Q15_FRACT_BITS);
+    if (v >= 32767.0f) {
+        return INT16_MAX;
+    } else if (v <= -32768.0f) {
+        return INT16_MIN;
+    }
+    return (eml_q15_t)((v >= 0.0f) ? (v + 0.5f) : (v - 0.5f));
+}
+
+static inline eml_q31_t
+eml_q31_from_float(double x)
+{
+    const double v = x * 2147483648.0;
+    if (v >= 2147483647.0) {
+        return INT32_MAX;
+    } else if (v <= -2147483648.0) {
+        return INT32_MIN;
+    }
+    return (eml_q31_t)((v >= 0.0) ? (v + 0.5) : (v - 0.5));
+}
+
 #ifdef __cplusplus
 }
 #endif
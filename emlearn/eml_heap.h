@@ -0,0 +1,76 @@
+
+/*
+ * Binary heap primitives, for partial sorting / top-k selection.
+ *
+ * Follows the same conventions as eml_qsort.h:
+ * all operations are performed on array indices,
+ * while access to the array elements is abstracted out with the
+ * user-defined `LESS` and `SWAP` primitives.
+ * The heap is a max-heap with respect to LESS, so element 0 is the largest.
+ *
+ * Synopsis:
+ *	EML_HEAP_SIFT_DOWN(N, ROOT, LESS, SWAP);
+ *	EML_HEAP_SIFT_UP(I, LESS, SWAP);
+ *	EML_HEAP_MAKE(N, LESS, SWAP);
+ *	EML_HEAP_SORT(N, LESS, SWAP);
+ * where
+ *	N - the number of elements in the heap;
+ *	LESS(i, j) - compares A[i] to A[j];
+ *	SWAP(i, j) - exchanges A[i] with A[j].
+ *
+ * Top-k smallest out of n elements, in O(n log k):
+ *	EML_HEAP_MAKE(k) on the first k elements, then for each remaining element
+ *	that is LESS than element 0, SWAP it into 0 and EML_HEAP_SIFT_DOWN(k, 0).
+ *	Finally EML_HEAP_SORT(k) leaves the k smallest in ascending order.
+ */
+
+#ifndef EML_HEAP_H
+#define EML_HEAP_H
+
+/* Move element q_root down until the heap [0, q_n) is valid again */
+#define EML_HEAP_SIFT_DOWN(q_n, q_root, Q_LESS, Q_SWAP)			\
+do {									\
+    long q_p = (q_root);						\
+    while (1) {								\
+	long q_c = 2*q_p + 1;						\
+	if (q_c >= (long)(q_n)) break;					\
+	if (q_c + 1 < (long)(q_n) && Q_LESS(q_c, q_c + 1)) q_c++;	\
+	if (!(Q_LESS(q_p, q_c))) break;					\
+	Q_SWAP(q_p, q_c);						\
+	q_p = q_c;							\
+    }									\
+} while (0)
+
+/* Move element q_i up until the heap [0, q_i] is valid again */
+#define EML_HEAP_SIFT_UP(q_i, Q_LESS, Q_SWAP)				\
+do {									\
+    long q_c = (q_i);							\
+    while (q_c > 0) {							\
+	long q_p = (q_c - 1) / 2;					\
+	if (!(Q_LESS(q_p, q_c))) break;					\
+	Q_SWAP(q_p, q_c);						\
+	q_c = q_p;							\
+    }									\
+} while (0)
+
+/* Arrange [0, q_n) into a heap */
+#define EML_HEAP_MAKE(q_n, Q_LESS, Q_SWAP)				\
+do {									\
+    long q_m;								\
+    for (q_m = (long)(q_n)/2 - 1; q_m >= 0; q_m--)			\
+	EML_HEAP_SIFT_DOWN(q_n, q_m, Q_LESS, Q_SWAP);			\
+} while (0)
+
+/* Sort a heap [0, q_n) into ascending order */
+#define EML_HEAP_SORT(q_n, Q_LESS, Q_SWAP)				\
+do {									\
+    long q_e;								\
+    for (q_e = (long)(q_n) - 1; q_e > 0; q_e--) {			\
+	Q_SWAP(0, q_e);							\
+	EML_HEAP_SIFT_DOWN(q_e, 0, Q_LESS, Q_SWAP);			\
+    }									\
+} while (0)
+
+#endif
+
+/* ex:set ts=8 sts=4 sw=4 noet: */
@@ -97,6 +97,10 @@ Add an integer value
 */
 #define EML_LOG_ADD_INTEGER(key, integer)           EML_LOG_PRINTF(" %s=%d", key, integer)
 /**
+Add a 64 bit integer value
+*/
+#define EML_LOG_ADD_INTEGER64(key, integer)         EML_LOG_PRINTF(" %s=%lld", key, (long long)(integer))
+/**
 Add a boolean value
 */
 #define EML_LOG_ADD_BOOL(key, boolean)              EML_LOG_PRINTF(" %s=%s", key, (boolean) ? "true" : "false")
@@ -14,6 +14,16 @@ extern "C" {
 // numpy.log(2*numpy.pi)
 #define EML_LOG_2PI 1.8378770664093453
 
+// Number of samples processed together by eml_mixture_score_batch()
+#ifndef EML_MIXTURE_BATCH_SAMPLES
+#define EML_MIXTURE_BATCH_SAMPLES 8
+#endif
+
+// Maximum number of features supported by eml_mixture_score_batch()
+#ifndef EML_MIXTURE_MAX_FEATURES
+#define EML_MIXTURE_MAX_FEATURES 64
+#endif
+
 bool
 eml_dot_product(float *a, float *b, int n)
 {
@@ -106,6 +116,14 @@ typedef struct _EmlMixtureModel {
     // FIXME: combine log_dets and log_weights?
    const float *log_dets; // n_components
    const float *log_weights; // n_components
+
+   // Optional. means projected by the precisions, for full and tied covariance.
+   // n_components * n_features. NULL means computed for each sample
+   const float *mean_projections;
+
+   // When non-zero, full and tied precisions store only the upper triangle,
+   // column by column: column f has the f+1 entries of rows 0..f
+   int32_t precisions_packed;
 } EmlMixtureModel;
 
 
@@ -116,12 +134,15 @@ eml_mixture_precisions_length(EmlMixtureModel *model)
     const int32_t features = model->n_features;
     const int32_t components = model->n_components;
 
+    const int32_t matrix = (model->precisions_packed) ? \
+        ((features * (features+1)) / 2) : (features * features);
+
     switch (model->covariance_type) {
         case EmlCovarianceFull:
-            length = (components * features * features);
+            length = (components * matrix);
             break;
         case EmlCovarianceTied:
-            length = (features * features);
+            length = (matrix);
             break;
         case EmlCovarianceDiagonal:
             length = (components * features);
@@ -134,6 +155,38 @@ eml_mixture_precisions_length(EmlMixtureModel *model)
     return length;
 }
 
+// Project values onto column f of a (triangular) precision matrix
+static inline float
+eml_mixture_project(const EmlMixtureModel *model, const float *precisions,
+                    const float *values, int f)
+{
+    const int n_features = model->n_features;
+    float dot = 0.0;
+    if (model->precisions_packed) {
+        // upper triangular, only rows 0..f are non-zero
+        const float *column = precisions + ((f*(f+1))/2);
+        for (int p=0; p<=f; p++) {
+            dot += (values[p] * column[p]);
+        }
+    } else {
+        for (int p=0; p<n_features; p++) {
+            dot += (values[p] * precisions[(p*n_features)+f]);
+        }
+    }
+    return dot;
+}
+
+// Projection of the means of component c onto column f of its precisions
+static inline float
+eml_mixture_mean_projection(const EmlMixtureModel *model, const float *precisions,
+                    int c, int f)
+{
+    if (model->mean_projections) {
+        return model->mean_projections[(c*model->n_features)+f];
+    }
+    return eml_mixture_project(model, precisions, model->means + (c*model->n_features), f);
+}
+
 #if 0
 void
 print_array(const float *array, int n) {
@@ -171,77 +224,85 @@ eml_mixture_predict_log_proba(EmlMixtureModel *model,
 
     float *out = probabilities;
     const int n_features = model->n_features;
+    const int n_components = model->n_components;
 
-    for (int c=0; c<model->n_components; c++) {
-        
-        const float *means = model->means + (c*n_features);
-      
-#if 0  
-        printf("means: ");
-        print_array(means, n_features);
-        printf("\n");
-#endif
-
-        float log_prob = 0.0;
+    // Squared Mahalanobis distance to each component, accumulated in out
+    switch (model->covariance_type) {
 
-        switch (model->covariance_type) {
+        case EmlCovarianceFull:
 
-            case EmlCovarianceFull:
+            for (int c=0; c<n_components; c++) {
+                const int matrix = (model->precisions_packed) ? \
+                    ((n_features*(n_features+1))/2) : (n_features*n_features);
+                const float *precisions = model->precisions + (c*matrix);
 
+                float log_prob = 0.0;
                 for (int f=0; f<n_features; f++) {
-
-                    const float *precisions = model->precisions + (c*n_features*n_features);
-                    const int n_precisions = model->n_features; // per feature, for this component 
-#if 0
-                    printf("precisions: ");
-                    print_array(precisions, n_precisions);
-                    printf("\n");
-#endif
-                    float dot_x = 0.0;
-                    float dot_m = 0.0;
-                    for (int p=0; p<n_precisions; p++) {
-                        dot_x += (values[p] * precisions[(p*n_features)+f]);
-                        dot_m += (means[p] * precisions[(p*n_features)+f]);
-                    }
+                    const float dot_x = eml_mixture_project(model, precisions, values, f);
+                    const float dot_m = eml_mixture_mean_projection(model, precisions, c, f);
                     const float y = (dot_x - dot_m);
-#if 0
-                    printf("c_yy component=%d feature=%d y=%.4f dot_x=%.4f dot_m=%.4f  \n",
-                            c, f, y, dot_x, dot_m);
-#endif
-
                     log_prob += (y*y);
                 }
-#if 0
-                printf("c_log_prob component=%d log_prob=%.4f  \n", c, log_prob);
-#endif
+                out[c] = log_prob;
+            }
+            break;
 
-                break;
+        case EmlCovarianceTied:
 
-            case EmlCovarianceTied:
-                return EmlUnsupported;
-                break;
+            // All components share one precision matrix,
+            // so the projection of the input is computed once, and reused for each component
+            for (int c=0; c<n_components; c++) {
+                out[c] = 0.0;
+            }
+            for (int f=0; f<n_features; f++) {
+                const float *precisions = model->precisions;
+                const float dot_x = eml_mixture_project(model, precisions, values, f);
+                for (int c=0; c<n_components; c++) {
+                    const float dot_m = eml_mixture_mean_projection(model, precisions, c, f);
+                    const float y = (dot_x - dot_m);
+                    out[c] += (y*y);
+                }
+            }
+            break;
 
-            case EmlCovarianceDiagonal:
-                return EmlUnsupported;
-                break;
+        case EmlCovarianceDiagonal:
 
-            case EmlCovarianceSpherical:
-                return EmlUnsupported;
-                break;
+            for (int c=0; c<n_components; c++) {
+                const float *means = model->means + (c*n_features);
+                const float *precisions = model->precisions + (c*n_features);
 
-        }
+                float log_prob = 0.0;
+                for (int f=0; f<n_features; f++) {
+                    const float y = (values[f] - means[f]) * precisions[f];
+                    log_prob += (y*y);
+                }
+                out[c] = log_prob;
+            }
+            break;
 
-        out[c] = -0.5 * (n_features * EML_LOG_2PI + log_prob ) + model->log_dets[c];
+        case EmlCovarianceSpherical:
 
-#if 0
-        printf("c_s component=%d s=%.4f log_det=%.4f weight=%.4f \n",
-                c, out[c], model->log_dets[c], model->log_weights[c]);
-#endif
+            for (int c=0; c<n_components; c++) {
+                const float *means = model->means + (c*n_features);
+                const float precision = model->precisions[c];
 
-        out[c] += model->log_weights[c];
+                float sum = 0.0;
+                for (int f=0; f<n_features; f++) {
+                    const float d = (values[f] - means[f]);
+                    sum += (d*d);
+                }
+                out[c] = sum * (precision*precision);
+            }
+            break;
 
+        default:
+            return EmlUnsupported;
     }
 
+    for (int c=0; c<n_components; c++) {
+        out[c] = -0.5 * (n_features * EML_LOG_2PI + out[c]) + model->log_dets[c];
+        out[c] += model->log_weights[c];
+    }
 
    return EmlOk;
 }
@@ -287,6 +348,179 @@ eml_mixture_score(EmlMixtureModel *model,
     return EmlOk;
 }
 
+// Squared Mahalanobis distance from a block of samples to component c
+// xt holds the samples transposed, [feature][sample]. For tied covariance, the projected samples
+static inline void
+eml_mixture_block_distances(const EmlMixtureModel *model, int c,
+                    const float *xt, float *dist)
+{
+    const int n_features = model->n_features;
+    const int B = EML_MIXTURE_BATCH_SAMPLES;
+
+    for (int s=0; s<B; s++) {
+        dist[s] = 0.0;
+    }
+
+    // Inner loops run over the samples of the block,
+    // which are independent and contiguous, so the compiler can vectorize them
+    switch (model->covariance_type) {
+
+        case EmlCovarianceFull: {
+            const int matrix = (model->precisions_packed) ? \
+                ((n_features*(n_features+1))/2) : (n_features*n_features);
+            const float *precisions = model->precisions + (c*matrix);
+
+            for (int f=0; f<n_features; f++) {
+                float acc[EML_MIXTURE_BATCH_SAMPLES] = { 0.0 };
+                const int rows = (model->precisions_packed) ? (f+1) : n_features;
+                for (int p=0; p<rows; p++) {
+                    const float w = (model->precisions_packed) ? \
+                        precisions[((f*(f+1))/2)+p] : precisions[(p*n_features)+f];
+                    const float *x = xt + (p*B);
+                    for (int s=0; s<B; s++) {
+                        acc[s] += (x[s] * w);
+                    }
+                }
+                const float m = eml_mixture_mean_projection(model, precisions, c, f);
+                for (int s=0; s<B; s++) {
+                    const float y = (acc[s] - m);
+                    dist[s] += (y*y);
+                }
+            }
+            } break;
+
+        case EmlCovarianceTied:
+            // samples were already projected by the shared precisions
+            for (int f=0; f<n_features; f++) {
+                const float m = eml_mixture_mean_projection(model, model->precisions, c, f);
+                const float *x = xt + (f*B);
+                for (int s=0; s<B; s++) {
+                    const float y = (x[s] - m);
+                    dist[s] += (y*y);
+                }
+            }
+            break;
+
+        case EmlCovarianceDiagonal: {
+            const float *means = model->means + (c*n_features);
+            const float *precisions = model->precisions + (c*n_features);
+            for (int f=0; f<n_features; f++) {
+                const float *x = xt + (f*B);
+                for (int s=0; s<B; s++) {
+                    const float y = (x[s] - means[f]) * precisions[f];
+                    dist[s] += (y*y);
+                }
+            }
+            } break;
+
+        case EmlCovarianceSpherical: {
+            const float *means = model->means + (c*n_features);
+            const float precision = model->precisions[c];
+            for (int f=0; f<n_features; f++) {
+                const float *x = xt + (f*B);
+                for (int s=0; s<B; s++) {
+                    const float d = (x[s] - means[f]);
+                    dist[s] += (d*d);
+                }
+            }
+            for (int s=0; s<B; s++) {
+                dist[s] *= (precision*precision);
+            }
+            } break;
+    }
+}
+
+/**
+* \brief Run inference on multiple samples, returning log-probabilities and outlier scores
+*
+* Same results as calling eml_mixture_score() for each sample.
+* Samples are processed in blocks of EML_MIXTURE_BATCH_SAMPLES,
+* so the precisions of each component are read once per block instead of once per sample.
+*
+* \param model Model instance
+* \param values Input data values (n_samples * values_length)
+* \param n_samples Number of samples
+* \param values_length Number of features per sample. Max EML_MIXTURE_MAX_FEATURES
+* \param probabilities Return location for log-probabilities (n_samples * n_components)
+* \param out_scores Return location for the outlier score of each sample (n_samples)
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+int32_t
+eml_mixture_score_batch(EmlMixtureModel *model,
+                    const float values[], int32_t n_samples, int32_t values_length,
+                    float *probabilities,
+                    float *out_scores)
+{
+    EML_PRECONDITION(model, -EmlUninitialized);
+    EML_PRECONDITION(values, -EmlUninitialized);
+    EML_PRECONDITION(model->n_components > 0, -EmlUninitialized);
+    EML_PRECONDITION(values_length == model->n_features, -EmlSizeMismatch);
+    EML_PRECONDITION(values_length <= EML_MIXTURE_MAX_FEATURES, -EmlUnsupported);
+    EML_PRECONDITION(model->covariance_type <= EmlCovarianceSpherical, -EmlUnsupported);
+
+    const int n_features = model->n_features;
+    const int n_components = model->n_components;
+    const int B = EML_MIXTURE_BATCH_SAMPLES;
+
+    float xt[EML_MIXTURE_MAX_FEATURES * EML_MIXTURE_BATCH_SAMPLES];
+    float projected[EML_MIXTURE_MAX_FEATURES * EML_MIXTURE_BATCH_SAMPLES];
+    float dist[EML_MIXTURE_BATCH_SAMPLES];
+
+    for (int start=0; start<n_samples; start+=B) {
+        const int remaining = n_samples - start;
+        const int n = (remaining < B) ? remaining : B;
+
+        // Transpose the block, padding with zeros
+        for (int f=0; f<n_features; f++) {
+            for (int s=0; s<B; s++) {
+                xt[(f*B)+s] = (s < n) ? values[((start+s)*n_features)+f] : 0.0f;
+            }
+        }
+
+        const float *block = xt;
+        if (model->covariance_type == EmlCovarianceTied) {
+            // Shared precisions, project the samples once for all components
+            for (int f=0; f<n_features; f++) {
+                float acc[EML_MIXTURE_BATCH_SAMPLES] = { 0.0 };
+                for (int p=0; p<n_features; p++) {
+                    if (model->precisions_packed && p > f) {
+                        break;
+                    }
+                    const float w = (model->precisions_packed) ? \
+                        model->precisions[((f*(f+1))/2)+p] : model->precisions[(p*n_features)+f];
+                    for (int s=0; s<B; s++) {
+                        acc[s] += (xt[(p*B)+s] * w);
+                    }
+                }
+                for (int s=0; s<B; s++) {
+                    projected[(f*B)+s] = acc[s];
+                }
+            }
+            block = projected;
+        }
+
+        for (int c=0; c<n_components; c++) {
+            eml_mixture_block_distances(model, c, block, dist);
+            const float offset = model->log_dets[c] + model->log_weights[c];
+            for (int s=0; s<n; s++) {
+                probabilities[((start+s)*n_components)+c] = \
+                    -0.5 * (n_features * EML_LOG_2PI + dist[s]) + offset;
+            }
+        }
+
+        for (int s=0; s<n; s++) {
+            const EmlError status = \
+                eml_logsumexp(probabilities + ((start+s)*n_components), n_components, &out_scores[start+s]);
+            if (status != EmlOk) {
+                return -status;
+            }
+        }
+    }
+
+    return EmlOk;
+}
+
 int32_t eml_mixture_predict_proba(EmlMixtureModel *model,
                     const float values[], int32_t values_length,
                     float *probabilities,
@@ -311,6 +545,287 @@ int32_t eml_mixture_predict_proba(EmlMixtureModel *model,
     
 }
 
+/**
+* \brief State for online updates of a EmlMixtureModel
+*
+* The arrays must be the (writable) arrays that the model points to.
+* Normally initialized by code generated using emlearn, with online=True
+*/
+typedef struct _EmlMixtureOnline {
+    float *means;
+    float *precisions;
+    float *log_dets;
+    float *log_weights;
+    float *mean_projections; // NULL if the model has none
+
+    float *scratch; // working memory, see eml_mixture_online_scratch_length
+    int32_t scratch_length;
+
+    // Fraction of the statistics replaced by each sample.
+    // Constant, so old samples are forgotten exponentially and drift is tracked
+    float step_size;
+    // Lower bound for variances (diagonal and spherical)
+    float min_variance;
+} EmlMixtureOnline;
+
+int
+eml_mixture_online_scratch_length(EmlMixtureModel *model)
+{
+    return (2 * model->n_components) + (3 * model->n_features);
+}
+
+// Location of entry (row, col) of the upper triangular precisions factor
+static inline int
+eml_mixture_precisions_index(const EmlMixtureModel *model, int row, int col)
+{
+    if (model->precisions_packed) {
+        return ((col*(col+1))/2) + row;
+    }
+    return (row*model->n_features) + col;
+}
+
+// Update the precisions factor U of one component for covariance' = (1-rate)*(covariance + rate*d*d^T)
+// Via Sherman-Morrison this is a rank-1 downdate of the precisions U*U^T, done in-place in O(n_features^2)
+// With check_only, nothing is written, but the result is the same as the actual update would give.
+// Each entry is only read before it is updated, so the downdate can be evaluated without storing it
+static inline EmlError
+eml_mixture_update_full(const EmlMixtureModel *model, float *precisions,
+            const float *d, float rate, float *u, float *v, float *log_det, int check_only)
+{
+    const int n_features = model->n_features;
+
+    // u = U^T d
+    float uu = 0.0f;
+    for (int j=0; j<n_features; j++) {
+        float sum = 0.0f;
+        for (int i=0; i<=j; i++) {
+            sum += precisions[eml_mixture_precisions_index(model, i, j)] * d[i];
+        }
+        u[j] = sum;
+        uu += (sum*sum);
+    }
+    // v = U u = precision * d
+    for (int i=0; i<n_features; i++) {
+        float sum = 0.0f;
+        for (int j=i; j<n_features; j++) {
+            sum += precisions[eml_mixture_precisions_index(model, i, j)] * u[j];
+        }
+        v[i] = sum;
+    }
+    // precision' = (precision - alpha*v*v^T) / (1-rate)
+    const float alpha = rate / (1.0f + (rate*uu));
+    const float scale = sqrtf(alpha);
+    for (int i=0; i<n_features; i++) {
+        v[i] *= scale;
+    }
+
+    // Cholesky downdate. U is upper triangular with U*U^T,
+    // so the usual algorithm for lower triangular L*L^T runs in reverse order
+    for (int k=n_features-1; k>=0; k--) {
+        const int kk = eml_mixture_precisions_index(model, k, k);
+        const float diag = precisions[kk];
+        const float r2 = (diag*diag) - (v[k]*v[k]);
+        if (!(r2 > 0.0f)) {
+            return EmlUnknownError; // not positive definite anymore
+        }
+        const float r = sqrtf(r2);
+        const float c = r / diag;
+        const float s = v[k] / diag;
+        if (!check_only) {
+            precisions[kk] = r;
+        }
+        for (int i=k-1; i>=0; i--) {
+            const int ik = eml_mixture_precisions_index(model, i, k);
+            const float updated = (precisions[ik] - (s*v[i])) / c;
+            if (!check_only) {
+                precisions[ik] = updated;
+            }
+            v[i] = (c*v[i]) - (s*updated);
+        }
+    }
+    if (check_only) {
+        return EmlOk;
+    }
+
+    const float factor = 1.0f / sqrtf(1.0f - rate);
+    float sum_log = 0.0f;
+    for (int j=0; j<n_features; j++) {
+        for (int i=0; i<=j; i++) {
+            precisions[eml_mixture_precisions_index(model, i, j)] *= factor;
+        }
+        sum_log += logf(precisions[eml_mixture_precisions_index(model, j, j)]);
+    }
+    *log_det = sum_log;
+
+    return EmlOk;
+}
+
+// Fraction of the statistics of a component that are replaced by a sample with responsibility r.
+// Also returns the updated mixture weight of the component. 0 means the component is not updated
+static inline float
+eml_mixture_online_rate(float step_size, float log_weight, float r, float *out_weight)
+{
+    const float weight = ((1.0f - step_size) * expf(log_weight)) + (step_size * r);
+    *out_weight = weight;
+
+    const float rate = (step_size * r) / weight;
+    if (rate < 1e-6f) {
+        return 0.0f;
+    }
+    // A component with weight close to step_size*r would otherwise get rate close to 1,
+    // collapsing its covariance to (1-rate)*(...) ~ 0 around this single sample.
+    // Keeping at least half of the previous statistics keeps the precision finite
+    if (rate > 0.5f) {
+        return 0.5f;
+    }
+    return rate;
+}
+
+/**
+* \brief Update the model with a new sample, using stepwise (online) Expectation-Maximization
+*
+* Moves weights, means and precisions of each component towards the sample,
+* in proportion to its responsibility. Uses fixed memory, and O(n_components * n_features^2)
+* for full covariance (rank-1 Cholesky downdate), O(n_components * n_features) for diagonal and spherical.
+* Tied covariance is not supported.
+*
+* Assumes the log_weights are log mixture weights, as for GaussianMixture.
+*
+* For full covariance, the downdate of every component is checked before anything is written.
+* On error the model is left unchanged, for all covariance types.
+*
+* \param model Model instance
+* \param state Online update state, pointing to the arrays of the model
+* \param values Input data values
+* \param values_length Input data values
+*
+* \return EmlOk on success, or error on failure
+*/
+int32_t
+eml_mixture_update(EmlMixtureModel *model, EmlMixtureOnline *state,
+                    const float values[], int32_t values_length)
+{
+    EML_PRECONDITION(model, -EmlUninitialized);
+    EML_PRECONDITION(state, -EmlUninitialized);
+    EML_PRECONDITION(values_length == model->n_features, -EmlSizeMismatch);
+    EML_PRECONDITION(state->means == model->means, -EmlUninitialized);
+    EML_PRECONDITION(state->precisions == model->precisions, -EmlUninitialized);
+    EML_PRECONDITION(state->log_dets == model->log_dets, -EmlUninitialized);
+    EML_PRECONDITION(state->log_weights == model->log_weights, -EmlUninitialized);
+    EML_PRECONDITION(state->mean_projections == model->mean_projections, -EmlUninitialized);
+    EML_PRECONDITION(state->scratch_length >= eml_mixture_online_scratch_length(model), -EmlSizeMismatch);
+    EML_PRECONDITION(state->step_size > 0.0f && state->step_size < 1.0f, -EmlUnsupported);
+    EML_PRECONDITION(model->covariance_type != EmlCovarianceTied, -EmlUnsupported);
+    EML_PRECONDITION(model->covariance_type <= EmlCovarianceSpherical, -EmlUnsupported);
+
+    const int n_features = model->n_features;
+    const int n_components = model->n_components;
+    float *log_proba = state->scratch;
+    float *resp = log_proba + n_components;
+    float *d = resp + n_components;
+    float *u = d + n_features;
+    float *v = u + n_features;
+
+    // E-step, for this sample only
+    float score = 0.0f;
+    const int32_t status = \
+        eml_mixture_predict_proba(model, values, values_length, log_proba, &score, resp);
+    if (status != EmlOk) {
+        return status;
+    }
+
+    const float eta = state->step_size;
+    const int matrix = (model->precisions_packed) ? \
+        ((n_features*(n_features+1))/2) : (n_features*n_features);
+
+    // Fail before modifying the model, if the precisions of any component cannot be downdated
+    if (model->covariance_type == EmlCovarianceFull) {
+        for (int c=0; c<n_components; c++) {
+            float weight = 0.0f;
+            const float rate = eml_mixture_online_rate(eta, state->log_weights[c], resp[c], &weight);
+            if (rate == 0.0f) {
+                continue;
+            }
+            const float *means = state->means + (c*n_features);
+            for (int f=0; f<n_features; f++) {
+                d[f] = values[f] - means[f];
+            }
+            const EmlError err = eml_mixture_update_full(model, state->precisions + (c*matrix),
+                d, rate, u, v, NULL, 1);
+            if (err != EmlOk) {
+                return -err;
+            }
+        }
+    }
+
+    // M-step, as a step towards the statistics of this sample
+    for (int c=0; c<n_components; c++) {
+        float weight = 0.0f;
+        const float rate = eml_mixture_online_rate(eta, state->log_weights[c], resp[c], &weight);
+        state->log_weights[c] = logf(weight);
+        if (rate == 0.0f) {
+            continue;
+        }
+
+        float *means = state->means + (c*n_features);
+        float sum_sq = 0.0f;
+        for (int f=0; f<n_features; f++) {
+            d[f] = values[f] - means[f];
+            sum_sq += (d[f]*d[f]);
+            means[f] += (rate * d[f]);
+        }
+
+        // covariance' = (1-rate)*(covariance + rate*d*d^T)
+        switch (model->covariance_type) {
+            case EmlCovarianceFull: {
+                float *precisions = state->precisions + (c*matrix);
+                const EmlError err = \
+                    eml_mixture_update_full(model, precisions, d, rate, u, v, &state->log_dets[c], 0);
+                if (err != EmlOk) {
+                    return -err; // not reached, checked above
+                }
+                if (state->mean_projections) {
+                    for (int f=0; f<n_features; f++) {
+                        state->mean_projections[(c*n_features)+f] = \
+                            eml_mixture_project(model, precisions, means, f);
+                    }
+                }
+                } break;
+
+            case EmlCovarianceDiagonal: {
+                float *precisions = state->precisions + (c*n_features);
+                float sum_log = 0.0f;
+                for (int f=0; f<n_features; f++) {
+                    const float variance = 1.0f / (precisions[f]*precisions[f]);
+                    float updated = (1.0f - rate) * (variance + (rate * d[f]*d[f]));
+                    if (updated < state->min_variance) {
+                        updated = state->min_variance;
+                    }
+                    precisions[f] = 1.0f / sqrtf(updated);
+                    sum_log += logf(precisions[f]);
+                }
+                state->log_dets[c] = sum_log;
+                } break;
+
+            case EmlCovarianceSpherical: {
+                const float precision = state->precisions[c];
+                const float variance = 1.0f / (precision*precision);
+                float updated = (1.0f - rate) * (variance + (rate * sum_sq / n_features));
+                if (updated < state->min_variance) {
+                    updated = state->min_variance;
+                }
+                state->precisions[c] = 1.0f / sqrtf(updated);
+                state->log_dets[c] = n_features * logf(state->precisions[c]);
+                } break;
+
+            default:
+                return -EmlUnsupported;
+        }
+    }
+
+    return EmlOk;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,18 +12,66 @@ in order to support on-device learning.
 #include <eml_common.h>
 #include <eml_log.h>
 #include <eml_qsort.h>
+#include <eml_heap.h>
 
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
 
 // Configuration options
 #ifndef EML_NEIGHBORS_LOG_LEVEL
 #define EML_NEIGHBORS_LOG_LEVEL 0
 #endif // EML_NEIGHBORS_LOG_LEVEL
 
-#ifndef EML_NEIGHBORS_MAX_CLASSES
-#define EML_NEIGHBORS_MAX_CLASSES 10
-#endif // EML_NEIGHBORS_MAX_CLASSES
+// Accumulate squared distances in 64 bits. Needed when n_features*(max difference)^2 can exceed 2^32
+#ifndef EML_NEIGHBORS_DISTANCE_64
+#define EML_NEIGHBORS_DISTANCE_64 0
+#endif // EML_NEIGHBORS_DISTANCE_64
+
+// Maximum depth of the optional KD-tree index
+#ifndef EML_NEIGHBORS_TREE_MAX_DEPTH
+#define EML_NEIGHBORS_TREE_MAX_DEPTH 32
+#endif // EML_NEIGHBORS_TREE_MAX_DEPTH
+
+// Stop computing the distance to an item once it cannot be among the k nearest
+#ifndef EML_NEIGHBORS_EARLY_ABANDON
+#define EML_NEIGHBORS_EARLY_ABANDON 1
+#endif // EML_NEIGHBORS_EARLY_ABANDON
+
+// Number of features between each check for abandoning
+#ifndef EML_NEIGHBORS_ABANDON_BLOCK
+#define EML_NEIGHBORS_ABANDON_BLOCK 16
+#endif // EML_NEIGHBORS_ABANDON_BLOCK
+
+// Maximum number of features, when the model uses a feature_order
+#ifndef EML_NEIGHBORS_MAX_FEATURES
+#define EML_NEIGHBORS_MAX_FEATURES 128
+#endif // EML_NEIGHBORS_MAX_FEATURES
+
+// Number of queries processed together by the batch functions
+// Each item is loaded once per batch, instead of once per query
+#ifndef EML_NEIGHBORS_BATCH_QUERIES
+#define EML_NEIGHBORS_BATCH_QUERIES 8
+#endif // EML_NEIGHBORS_BATCH_QUERIES
+
+// Use AVX2/NEON distance kernels when the compiler targets them
+#ifndef EML_NEIGHBORS_SIMD
+#define EML_NEIGHBORS_SIMD 1
+#endif // EML_NEIGHBORS_SIMD
+
+#if EML_NEIGHBORS_SIMD && defined(__AVX2__)
+#define EML_NEIGHBORS_AVX2 1
+#include <immintrin.h>
+#elif EML_NEIGHBORS_SIMD && defined(__ARM_NEON)
+#define EML_NEIGHBORS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if EML_NEIGHBORS_DISTANCE_64
+typedef uint64_t EmlNeighborsDistance;
+#else
+typedef uint32_t EmlNeighborsDistance;
+#endif
 
 
 int32_t eml_isqrt(int32_t x)
@@ -45,20 +93,159 @@ int32_t eml_isqrt(int32_t x)
     return r;
 }
 
-uint32_t
-eml_distance_euclidean_int16(const int16_t *a, const int16_t *b, int length)
+/**
+* \brief Integer square root, for the full range of EmlNeighborsDistance
+*/
+static inline EmlNeighborsDistance
+eml_neighbors_isqrt(EmlNeighborsDistance x)
 {
-    // FIXME: test this with large values
-    uint32_t ret = 0;
-    for (int i=0; i<length; i++) {
-        const int32_t diff = a[i] - b[i];        
-        const int32_t d = diff * diff;
-        ret += d;
+    EmlNeighborsDistance q = ((EmlNeighborsDistance)1) << (sizeof(EmlNeighborsDistance)*8 - 2);
+    EmlNeighborsDistance r = 0;
+    while (q > x) {
+        q >>= 2;
+    }
+    while (q != 0) {
+        if (x >= r + q) {
+            x -= r + q;
+            r = (r >> 1) + q;
+        } else {
+            r >>= 1;
+        }
+        q >>= 2;
+    }
+    return r;
+}
+
+/**
+* \brief Squared euclidean distance between two int16 vectors
+*
+* Exact for all int16 inputs, as long as the sum fits in EmlNeighborsDistance.
+* Squared distances have the same ranking as distances, so no square root is needed for kNN.
+*/
+static inline EmlNeighborsDistance
+eml_distance_sqeuclidean_int16(const int16_t *a, const int16_t *b, int length)
+{
+    EmlNeighborsDistance ret = 0;
+    int i = 0;
+
+#if EML_NEIGHBORS_AVX2
+    // 16 features per iteration. pmaddwd on the differences,
+    // with an exact 32 bit path for blocks where a difference does not fit in int16
+#if EML_NEIGHBORS_DISTANCE_64
+    __m256i acc = _mm256_setzero_si256();
+#else
+    __m256i acc32 = _mm256_setzero_si256();
+#endif
+    for (; i+16<=length; i+=16) {
+        const __m256i va = _mm256_loadu_si256((const __m256i *)(a+i));
+        const __m256i vb = _mm256_loadu_si256((const __m256i *)(b+i));
+        const __m256i diff = _mm256_subs_epi16(va, vb);
+        const __m256i wrapped = _mm256_sub_epi16(va, vb);
+        __m256i sq; // 8x uint32, each the sum of two squared differences
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(diff, wrapped)) == -1) {
+            sq = _mm256_madd_epi16(diff, diff);
+        } else {
+            const __m256i lo = _mm256_sub_epi32(
+                _mm256_cvtepi16_epi32(_mm256_castsi256_si128(va)),
+                _mm256_cvtepi16_epi32(_mm256_castsi256_si128(vb)));
+            const __m256i hi = _mm256_sub_epi32(
+                _mm256_cvtepi16_epi32(_mm256_extracti128_si256(va, 1)),
+                _mm256_cvtepi16_epi32(_mm256_extracti128_si256(vb, 1)));
+            const __m256i lo2 = _mm256_mullo_epi32(lo, lo);
+            const __m256i hi2 = _mm256_mullo_epi32(hi, hi);
+#if EML_NEIGHBORS_DISTANCE_64
+            acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(lo2)));
+            acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(lo2, 1)));
+            acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(hi2)));
+            acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(hi2, 1)));
+            continue;
+#else
+            sq = _mm256_add_epi32(lo2, hi2);
+#endif
+        }
+#if EML_NEIGHBORS_DISTANCE_64
+        acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(sq)));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(sq, 1)));
+#else
+        acc32 = _mm256_add_epi32(acc32, sq);
+#endif
+    }
+#if EML_NEIGHBORS_DISTANCE_64
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    ret += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, acc32);
+    for (int l=0; l<8; l++) {
+        ret += lanes[l];
+    }
+#endif
+
+#elif EML_NEIGHBORS_NEON
+    // 8 features per iteration. Widening subtract is exact, square as uint32
+#if EML_NEIGHBORS_DISTANCE_64
+    uint64x2_t acc = vdupq_n_u64(0);
+#else
+    uint32x4_t acc = vdupq_n_u32(0);
+#endif
+    for (; i+8<=length; i+=8) {
+        const int16x8_t va = vld1q_s16(a+i);
+        const int16x8_t vb = vld1q_s16(b+i);
+        const uint32x4_t lo = vreinterpretq_u32_s32(vsubl_s16(vget_low_s16(va), vget_low_s16(vb)));
+        const uint32x4_t hi = vreinterpretq_u32_s32(vsubl_s16(vget_high_s16(va), vget_high_s16(vb)));
+#if EML_NEIGHBORS_DISTANCE_64
+        acc = vpadalq_u32(acc, vmulq_u32(lo, lo));
+        acc = vpadalq_u32(acc, vmulq_u32(hi, hi));
+#else
+        acc = vmlaq_u32(acc, lo, lo);
+        acc = vmlaq_u32(acc, hi, hi);
+#endif
+    }
+#if EML_NEIGHBORS_DISTANCE_64
+    ret += vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#else
+    ret += vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#endif
+#endif
+
+    for (; i<length; i++) {
+        const int32_t diff = (int32_t)a[i] - (int32_t)b[i];
+        const uint32_t abs_diff = (uint32_t)((diff < 0) ? -diff : diff);
+        ret += (EmlNeighborsDistance)(abs_diff * abs_diff);
     }
-    ret = eml_isqrt(ret); 
     return ret;
 }
 
+/**
+* \brief Squared euclidean distance, abandoned once it exceeds limit
+*
+* Partial sums are checked every EML_NEIGHBORS_ABANDON_BLOCK features.
+* Returns the exact distance if it is <= limit, otherwise some value > limit.
+*/
+static inline EmlNeighborsDistance
+eml_distance_sqeuclidean_int16_bounded(const int16_t *a, const int16_t *b, int length,
+            EmlNeighborsDistance limit)
+{
+    EmlNeighborsDistance sum = 0;
+    for (int i=0; i<length; i+=EML_NEIGHBORS_ABANDON_BLOCK) {
+        const int remaining = length - i;
+        const int n = (remaining < EML_NEIGHBORS_ABANDON_BLOCK) ? remaining : EML_NEIGHBORS_ABANDON_BLOCK;
+        sum += eml_distance_sqeuclidean_int16(a+i, b+i, n);
+        if (sum > limit) {
+            break;
+        }
+    }
+    return sum;
+}
+
+uint32_t
+eml_distance_euclidean_int16(const int16_t *a, const int16_t *b, int length)
+{
+    const EmlNeighborsDistance sq = eml_distance_sqeuclidean_int16(a, b, length);
+    return (uint32_t)eml_neighbors_isqrt(sq);
+}
+
 /** @typedef EmlNeighborsDistanceItem
 * \brief Distance between input datapoint and a training datapoint
 *
@@ -66,7 +253,7 @@ eml_distance_euclidean_int16(const int16_t *a, const int16_t *b, int length)
 */
 typedef struct _EmlNeighborsDistanceItem {
     int16_t index;
-    uint32_t distance;
+    EmlNeighborsDistance distance; // squared euclidean distance
 } EmlNeighborsDistanceItem;
 
 EmlError
@@ -86,11 +273,218 @@ eml_neighbors_sort_distances(EmlNeighborsDistanceItem *distances, size_t length)
     return EmlOk;
 }
 
+// Order items by distance. Ties broken by index, so that results do not depend on scan order
+#define EML_NEIGHBORS_ITEM_LESS(a, b) \
+    ((a).distance < (b).distance || ((a).distance == (b).distance && (a).index < (b).index))
+
+/**
+* \brief Offer an item to a bounded max-heap holding the k nearest items
+*
+* heap[0] is always the furthest of the items kept.
+* Once the heap holds k items, an item is only kept if it is nearer than heap[0].
+*
+* \param heap Storage for the heap. Must have space for k items
+* \param heap_length Number of items currently in heap. Updated
+* \param k Maximum number of items to keep
+* \param item The candidate item
+*/
+static inline void
+eml_neighbors_topk_push(EmlNeighborsDistanceItem *heap, int *heap_length, int k,
+        EmlNeighborsDistanceItem item)
+{
+    EmlNeighborsDistanceItem *A = heap;
+    EmlNeighborsDistanceItem tmp;
+
+#define EML_LESS(i, j) EML_NEIGHBORS_ITEM_LESS(A[i], A[j])
+#define EML_SWAP(i, j) tmp = A[i], A[i] = A[j], A[j] = tmp
+
+    if (*heap_length < k) {
+        const int n = (*heap_length)++;
+        A[n] = item;
+        EML_HEAP_SIFT_UP(n, EML_LESS, EML_SWAP);
+    } else if (k > 0 && EML_NEIGHBORS_ITEM_LESS(item, A[0])) {
+        A[0] = item;
+        EML_HEAP_SIFT_DOWN(k, 0, EML_LESS, EML_SWAP);
+    }
+
+#undef EML_LESS
+#undef EML_SWAP
+}
+
+/**
+* \brief Sort the heap from eml_neighbors_topk_push() by ascending distance
+*/
+static inline void
+eml_neighbors_topk_sort(EmlNeighborsDistanceItem *heap, int heap_length)
+{
+    EmlNeighborsDistanceItem *A = heap;
+    EmlNeighborsDistanceItem tmp;
+
+#define EML_LESS(i, j) EML_NEIGHBORS_ITEM_LESS(A[i], A[j])
+#define EML_SWAP(i, j) tmp = A[i], A[i] = A[j], A[j] = tmp
+
+    EML_HEAP_SORT(heap_length, EML_LESS, EML_SWAP);
+
+#undef EML_LESS
+#undef EML_SWAP
+}
+
+/**
+* \brief Move the k nearest items to the start of distances, in ascending order
+*
+* Partial sort in O(n log k), in-place. The order of the remaining items is unspecified.
+*/
+EmlError
+eml_neighbors_select_nearest(EmlNeighborsDistanceItem *distances, int distances_length, int k)
+{
+    EML_PRECONDITION(k >= 0 && k <= distances_length, EmlSizeMismatch);
+
+    EmlNeighborsDistanceItem *A = distances;
+    EmlNeighborsDistanceItem tmp;
+
+#define EML_LESS(i, j) EML_NEIGHBORS_ITEM_LESS(A[i], A[j])
+#define EML_SWAP(i, j) tmp = A[i], A[i] = A[j], A[j] = tmp
+
+    if (k > 0) {
+        EML_HEAP_MAKE(k, EML_LESS, EML_SWAP);
+        for (int i=k; i<distances_length; i++) {
+            if (EML_LESS(i, 0)) {
+                EML_SWAP(i, 0);
+                EML_HEAP_SIFT_DOWN(k, 0, EML_LESS, EML_SWAP);
+            }
+        }
+        EML_HEAP_SORT(k, EML_LESS, EML_SWAP);
+    }
+
+#undef EML_LESS
+#undef EML_SWAP
+
+    return EmlOk;
+}
+
+/** @typedef EmlNeighborsCompressed
+* \brief Reference items stored as int8 codes, with per-feature offset and power-of-two scale
+*
+* Item values are reconstructed as (code * 2^shift) + offset, which always fits in int16.
+* Distances are computed between the exact input and the reconstructed items.
+*/
+typedef struct _EmlNeighborsCompressed {
+    int8_t *codes; // (max_items * n_features)
+    const int16_t *offsets; // n_features
+    const uint8_t *shifts; // n_features
+} EmlNeighborsCompressed;
+
+// Reconstructed value of an int8 code
+static inline int32_t
+eml_neighbors_decompress_value(int8_t code, int16_t offset, uint8_t shift)
+{
+    return ((int32_t)code * (1 << shift)) + offset;
+}
+
+/**
+* \brief Compress a value into an int8 code
+*
+* Rounds to nearest, half away from zero, and clamps so the reconstruction stays in int16.
+*/
+static inline int8_t
+eml_neighbors_compress_value(int16_t value, int16_t offset, uint8_t shift)
+{
+    const int32_t diff = (int32_t)value - offset;
+    const int32_t half = (shift > 0) ? (1 << (shift-1)) : 0;
+    int32_t code = (diff >= 0) ? ((diff + half) >> shift) : -((-diff + half) >> shift);
+    code = (code > INT8_MAX) ? INT8_MAX : (code < INT8_MIN) ? INT8_MIN : code;
+    while (code > INT8_MIN && eml_neighbors_decompress_value((int8_t)code, offset, shift) > INT16_MAX) {
+        code -= 1;
+    }
+    while (code < INT8_MAX && eml_neighbors_decompress_value((int8_t)code, offset, shift) < INT16_MIN) {
+        code += 1;
+    }
+    return (int8_t)code;
+}
+
+/**
+* \brief Squared euclidean distance between an int16 input and a compressed item
+*
+* Like eml_distance_sqeuclidean_int16_bounded(), abandoned once the distance exceeds limit.
+*/
+static inline EmlNeighborsDistance
+eml_distance_sqeuclidean_compressed(const int16_t *a, const int8_t *codes,
+            const int16_t *offsets, const uint8_t *shifts, int length,
+            EmlNeighborsDistance limit)
+{
+    EmlNeighborsDistance sum = 0;
+    for (int i=0; i<length; i+=EML_NEIGHBORS_ABANDON_BLOCK) {
+        const int remaining = length - i;
+        const int end = i + ((remaining < EML_NEIGHBORS_ABANDON_BLOCK) ? remaining : EML_NEIGHBORS_ABANDON_BLOCK);
+        int j = i;
+#if EML_NEIGHBORS_AVX2
+        // 8 features per iteration, reconstruction and difference in 32 bit
+        for (; j+8<=end; j+=8) {
+            const __m256i q = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(a+j)));
+            const __m256i c = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)(codes+j)));
+            const __m256i sh = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(shifts+j)));
+            const __m256i o = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(offsets+j)));
+            const __m256i diff = _mm256_sub_epi32(q, _mm256_add_epi32(_mm256_sllv_epi32(c, sh), o));
+            const __m256i sq = _mm256_mullo_epi32(diff, diff);
+#if EML_NEIGHBORS_DISTANCE_64
+            uint64_t lanes[4];
+            const __m256i sq64 = _mm256_add_epi64(
+                _mm256_cvtepu32_epi64(_mm256_castsi256_si128(sq)),
+                _mm256_cvtepu32_epi64(_mm256_extracti128_si256(sq, 1)));
+            _mm256_storeu_si256((__m256i *)lanes, sq64);
+            sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+            uint32_t lanes[8];
+            _mm256_storeu_si256((__m256i *)lanes, sq);
+            for (int l=0; l<8; l++) {
+                sum += lanes[l];
+            }
+#endif
+        }
+#endif
+        for (; j<end; j++) {
+            const int32_t diff = a[j] - eml_neighbors_decompress_value(codes[j], offsets[j], shifts[j]);
+            const uint32_t abs_diff = (uint32_t)((diff < 0) ? -diff : diff);
+            sum += (EmlNeighborsDistance)(abs_diff * abs_diff);
+        }
+        if (sum > limit) {
+            break;
+        }
+    }
+    return sum;
+}
+
+/** @typedef EmlNeighborsTreeNode
+* \brief Node of a KD-tree index over the items of a EmlNeighborsModel
+*
+* Inner nodes split on feature: all items under left have values <= value,
+* and all items under right have values >= value.
+* Leaf nodes have feature=-1, and cover the range of items [left, right).
+* Node and item indices are int16_t, like n_items in EmlNeighborsModel.
+*/
+typedef struct _EmlNeighborsTreeNode {
+    int16_t feature;
+    int16_t value;
+    int16_t left;
+    int16_t right;
+} EmlNeighborsTreeNode;
+
+/** @typedef EmlNeighborsWeighting
+* \brief How the k nearest items are weighted when voting / averaging
+*/
+typedef enum _EmlNeighborsWeighting {
+    EmlNeighborsWeightUniform = 0, // all items count the same
+    EmlNeighborsWeightDistance, // by inverse distance. Items at distance 0 take all the weight
+} EmlNeighborsWeighting;
+
 /** @typedef EmlNeighborsModel
 * \brief Nearest Neighbors Model
 *
 * Handle used to do inference.
 * Normally the initialization code is generated by emlearn.
+*
+* Item counts and indices are int16_t, so a model holds at most 32767 items,
+* and a KD-tree index at most 32767 nodes.
 */
 typedef struct _EmlNeighborsModel {
 
@@ -103,6 +497,28 @@ typedef struct _EmlNeighborsModel {
 
     int16_t k_neighbors;
 
+    // Optional KD-tree index. NULL means brute-force search
+    // The tree covers items [0, tree_items), items added after that are scanned
+    const EmlNeighborsTreeNode *tree_nodes; // tree_n_nodes, root is node 0
+    int16_t tree_n_nodes;
+    int16_t tree_items;
+
+    // Optional compressed storage of items. When set, this is used instead of data
+    const EmlNeighborsCompressed *compressed;
+
+    // State for replacing items when full. See eml_neighbors_add_item_fifo() etc
+    // Only items [tree_items, max_items) are ever replaced, so the KD-tree stays valid
+    int16_t replace_next; // next slot to replace, relative to tree_items
+    uint32_t n_seen; // items offered to eml_neighbors_add_item_reservoir()
+
+    // Number of classes, labels must be in [0, n_classes). 0 means not known
+    int16_t n_classes;
+    EmlNeighborsWeighting weighting;
+
+    // Optional permutation of features, applied to inputs. NULL means no reordering
+    // Ordering by descending variance makes abandoning distance computations happen earlier
+    const int16_t *feature_order; // n_features
+
 } EmlNeighborsModel;
 
 EmlError
@@ -116,12 +532,56 @@ eml_neighbors_check(EmlNeighborsModel *self,
     if (labels_length < self->max_items) {
         return EmlSizeMismatch;
     }
-    if (distances_length < self->max_items) {
+    // only the k nearest are kept during prediction
+    if (distances_length < self->k_neighbors) {
         return EmlSizeMismatch;
     }
     return EmlOk;
 }
 
+// Write values and label into the item at index, in the storage format of the model
+static inline void
+eml_neighbors_store_item(EmlNeighborsModel *self, int index,
+        const int16_t *values, int16_t label)
+{
+    const int n_features = self->n_features;
+    if (self->compressed) {
+        const EmlNeighborsCompressed *c = self->compressed;
+        int8_t *codes = c->codes + (n_features * index);
+        for (int i=0; i<n_features; i++) {
+            const int16_t v = (self->feature_order) ? values[self->feature_order[i]] : values[i];
+            codes[i] = eml_neighbors_compress_value(v, c->offsets[i], c->shifts[i]);
+        }
+    } else {
+        int16_t *data = self->data + (n_features * index);
+        if (self->feature_order) {
+            for (int i=0; i<n_features; i++) {
+                data[i] = values[self->feature_order[i]];
+            }
+        } else {
+            memcpy(data, values, sizeof(int16_t)*n_features);
+        }
+    }
+    self->labels[index] = label;
+}
+
+// Read the values of item at index, in the original feature order
+static inline void
+eml_neighbors_load_item(const EmlNeighborsModel *self, int index, int16_t *values)
+{
+    const int n_features = self->n_features;
+    for (int i=0; i<n_features; i++) {
+        int16_t v;
+        if (self->compressed) {
+            const EmlNeighborsCompressed *c = self->compressed;
+            v = eml_neighbors_decompress_value(c->codes[(n_features * index) + i], c->offsets[i], c->shifts[i]);
+        } else {
+            v = self->data[(n_features * index) + i];
+        }
+        values[(self->feature_order) ? self->feature_order[i] : i] = v;
+    }
+}
+
 /**
 * \brief Add a datapoint to the model / training set
 *
@@ -141,9 +601,7 @@ eml_neighbors_add_item(EmlNeighborsModel *self,
     EML_PRECONDITION(self->n_items < self->max_items, EmlSizeMismatch);
 
     const int index = self->n_items++;
-    int16_t *data = self->data + (self->n_features * index);
-    memcpy(data, values, sizeof(int16_t)*values_length);
-    self->labels[index] = label;    
+    eml_neighbors_store_item(self, index, values, label);
 
 #if EML_NEIGHBORS_LOG_LEVEL > 2
     EML_LOG_BEGIN("eml_neighbors_add_item");
@@ -155,6 +613,50 @@ eml_neighbors_add_item(EmlNeighborsModel *self,
     return EmlOk;
 }
 
+// Apply the feature_order of the model to input features. Returns the features to use
+static inline const int16_t *
+eml_neighbors_order_features(const EmlNeighborsModel *self, const int16_t *features, int16_t *ordered)
+{
+    if (!self->feature_order) {
+        return features;
+    }
+    for (int i=0; i<self->n_features; i++) {
+        ordered[i] = features[self->feature_order[i]];
+    }
+    return ordered;
+}
+
+// Squared distance from the input to item, for either storage. Abandoned once above limit
+static inline EmlNeighborsDistance
+eml_neighbors_item_distance(const EmlNeighborsModel *self, const int16_t *features,
+            int index, EmlNeighborsDistance limit)
+{
+    const int n_features = self->n_features;
+    if (self->compressed) {
+        const EmlNeighborsCompressed *c = self->compressed;
+        return eml_distance_sqeuclidean_compressed(features, c->codes + (n_features * index),
+                    c->offsets, c->shifts, n_features, limit);
+    }
+    const int16_t *item = self->data + (n_features * index);
+#if EML_NEIGHBORS_EARLY_ABANDON
+    if (limit != (EmlNeighborsDistance)-1) {
+        return eml_distance_sqeuclidean_int16_bounded(features, item, n_features, limit);
+    }
+#endif
+    return eml_distance_sqeuclidean_int16(features, item, n_features);
+}
+
+/**
+* \brief Compute the squared distance from the input datapoint to all items
+*
+* \param self EmlNeighborsModel instance
+* \param features Input data values
+* \param features_length Length of input data
+* \param distances Array to store the distances in
+* \param distances_length Length of distance array. Must be larger than model->n_items
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
 EmlError
 eml_neighbors_infer(EmlNeighborsModel *self,
             const int16_t *features, int features_length,
@@ -163,10 +665,15 @@ eml_neighbors_infer(EmlNeighborsModel *self,
     EML_PRECONDITION(distances_length >= self->n_items, EmlSizeMismatch);
     EML_PRECONDITION(features_length == self->n_features, EmlSizeMismatch);
 
+    // Items are stored with features in feature_order
+    int16_t ordered[EML_NEIGHBORS_MAX_FEATURES];
+    EML_PRECONDITION(!self->feature_order || features_length <= EML_NEIGHBORS_MAX_FEATURES, EmlUnsupported);
+    features = eml_neighbors_order_features(self, features, ordered);
+
     // compute distances to all items
     for (int i=0; i<self->n_items; i++) {
-        int16_t *item = self->data + (self->n_features * i);
-        uint32_t distance = eml_distance_euclidean_int16(features, item, features_length);
+        const EmlNeighborsDistance distance = \
+            eml_neighbors_item_distance(self, features, i, (EmlNeighborsDistance)-1);
 
         distances[i].index = i;
         distances[i].distance = distance;
@@ -174,7 +681,7 @@ eml_neighbors_infer(EmlNeighborsModel *self,
 #if EML_NEIGHBORS_LOG_LEVEL > 2
         EML_LOG_BEGIN("eml_neighbors_infer_iter");
         EML_LOG_ADD_INTEGER("index", i);
-        EML_LOG_ADD_INTEGER("distance", distance);
+        EML_LOG_ADD_INTEGER("distance", (int)distance);
         EML_LOG_ADD_INTEGER("label", self->labels[i]);
         EML_LOG_END();
 #endif
@@ -184,62 +691,303 @@ eml_neighbors_infer(EmlNeighborsModel *self,
     return EmlOk;
 }
 
-// FIXME: avoid hardcoding length
-int16_t eml_neighbors_votes[EML_NEIGHBORS_MAX_CLASSES];
+// Offer the items [start, end) to the top-k heap
+static inline void
+eml_neighbors_scan_items(const EmlNeighborsModel *self, const int16_t *features,
+            int start, int end,
+            EmlNeighborsDistanceItem *heap, int *found, int k)
+{
+    for (int i=start; i<end; i++) {
+        EmlNeighborsDistance limit = (EmlNeighborsDistance)-1;
+#if EML_NEIGHBORS_EARLY_ABANDON
+        if (*found == k && k > 0) {
+            // Abandoned items have distance > heap[0], and are rejected by the push
+            limit = heap[0].distance;
+        }
+#endif
+        EmlNeighborsDistanceItem d;
+        d.index = i;
+        d.distance = eml_neighbors_item_distance(self, features, i, limit);
+        eml_neighbors_topk_push(heap, found, k, d);
+    }
+}
 
+/**
+* \brief Search the KD-tree index, offering candidate items to the top-k heap
+*
+* A subtree is skipped only when its lower-bound distance is strictly larger than
+* the current k-th nearest, so the result is identical to a brute-force scan.
+*/
 EmlError
-eml_neighbors_find_nearest(EmlNeighborsModel *self,
-        EmlNeighborsDistanceItem *distances, int distances_length,
-        int k, int16_t *out)
+eml_neighbors_tree_search(const EmlNeighborsModel *self, const int16_t *features,
+            EmlNeighborsDistanceItem *heap, int *found, int k)
 {
-    EML_PRECONDITION(k <= distances_length, EmlSizeMismatch);
+    EML_PRECONDITION(self->tree_nodes, EmlUninitialized);
 
-#if EML_NEIGHBORS_LOG_LEVEL > 1
-        EML_LOG_BEGIN("eml_neighbors_find_nearest_start");
-        EML_LOG_ADD_INTEGER("distances", distances_length);
-        EML_LOG_ADD_INTEGER("items", distances_length);
-        EML_LOG_ADD_INTEGER("k", k);
-        EML_LOG_END();
-#endif
+    struct {
+        int16_t node;
+        EmlNeighborsDistance bound;
+    } stack[EML_NEIGHBORS_TREE_MAX_DEPTH+1];
+    int stack_length = 0;
 
-    // argsort by distance. NOTE: sorts in-place
-    eml_neighbors_sort_distances(distances, distances_length);
+    stack[stack_length].node = 0;
+    stack[stack_length].bound = 0;
+    stack_length += 1;
 
-    int16_t *votes = eml_neighbors_votes;
-    memset(votes, 0, sizeof(int16_t) * EML_NEIGHBORS_MAX_CLASSES);
+    while (stack_length > 0) {
+        stack_length -= 1;
+        const int16_t node_idx = stack[stack_length].node;
+        const EmlNeighborsDistance bound = stack[stack_length].bound;
 
-    // merge predictions for top-k matches
-    for (int i=0; i<k; i++) {
-        EmlNeighborsDistanceItem d = distances[i];
-        const int16_t label = self->labels[d.index];         
-        if (label < 0 || label >= EML_NEIGHBORS_MAX_CLASSES) {
-            return EmlUnknownError;
+        if (*found == k && k > 0 && bound > heap[0].distance) {
+            continue; // cannot contain any of the k nearest
         }
-        votes[label] += 1;
 
-#if EML_NEIGHBORS_LOG_LEVEL > 2
-        EML_LOG_BEGIN("eml_neighbors_find_nearest_k_iter");
-        EML_LOG_ADD_INTEGER("index", i);
-        EML_LOG_ADD_INTEGER("distance", d.distance);
-        EML_LOG_ADD_INTEGER("label", label);
-        EML_LOG_END();
+        const EmlNeighborsTreeNode *node = &self->tree_nodes[node_idx];
+        if (node->feature < 0) {
+            eml_neighbors_scan_items(self, features, node->left, node->right, heap, found, k);
+            continue;
+        }
+
+        const int32_t diff = (int32_t)features[node->feature] - (int32_t)node->value;
+        const uint32_t abs_diff = (uint32_t)((diff < 0) ? -diff : diff);
+        const EmlNeighborsDistance plane = (EmlNeighborsDistance)(abs_diff * abs_diff);
+        const int16_t near_child = (diff <= 0) ? node->left : node->right;
+        const int16_t far_child = (diff <= 0) ? node->right : node->left;
+
+        EML_PRECONDITION(stack_length+2 <= EML_NEIGHBORS_TREE_MAX_DEPTH+1, EmlUnsupported);
+        // far side is pushed first, so the near side is searched first
+        stack[stack_length].node = far_child;
+        stack[stack_length].bound = (plane > bound) ? plane : bound;
+        stack_length += 1;
+        stack[stack_length].node = near_child;
+        stack[stack_length].bound = bound;
+        stack_length += 1;
+    }
+
+    return EmlOk;
+}
+
+/**
+* \brief Find the k nearest items to the input datapoint
+*
+* Distances are computed and selected in the same pass,
+* keeping only a bounded heap of the k nearest. Storage is O(k) instead of O(n_items).
+* Uses the KD-tree index if the model has one, with the same results as brute-force.
+*
+* \param self EmlNeighborsModel instance
+* \param features Input data values
+* \param features_length Length of input data
+* \param k Number of neighbors to find. Must be <= model->n_items
+* \param nearest Array to return the k nearest items in, by ascending distance
+* \param nearest_length Length of nearest array. Must be >= k
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_infer_nearest(EmlNeighborsModel *self,
+            const int16_t *features, int features_length,
+            int k,
+            EmlNeighborsDistanceItem *nearest, int nearest_length)
+{
+    EML_PRECONDITION(features_length == self->n_features, EmlSizeMismatch);
+    EML_PRECONDITION(k >= 0 && k <= self->n_items, EmlSizeMismatch);
+    EML_PRECONDITION(nearest_length >= k, EmlSizeMismatch);
+
+    // Items are stored with features in feature_order
+    int16_t ordered[EML_NEIGHBORS_MAX_FEATURES];
+    EML_PRECONDITION(!self->feature_order || features_length <= EML_NEIGHBORS_MAX_FEATURES, EmlUnsupported);
+    features = eml_neighbors_order_features(self, features, ordered);
+
+    int found = 0;
+    int scan_start = 0;
+    if (self->tree_nodes && self->tree_n_nodes > 0) {
+        EML_CHECK_ERROR(eml_neighbors_tree_search(self, features, nearest, &found, k));
+        scan_start = self->tree_items;
+    }
+    eml_neighbors_scan_items(self, features, scan_start, self->n_items, nearest, &found, k);
+    eml_neighbors_topk_sort(nearest, found);
+
+    return EmlOk;
+}
+
+/**
+* \brief Find the k nearest items for each of multiple input datapoints
+*
+* Queries are processed in tiles of EML_NEIGHBORS_BATCH_QUERIES,
+* with each item compared against all queries in the tile while it is in cache.
+* This reduces memory traffic over the items by the tile size,
+* which matters when the items do not fit in cache. Same results as eml_neighbors_infer_nearest().
+* Models with a KD-tree index or a feature_order are searched one query at a time,
+* so that no tile of reordered queries is needed on the stack.
+*
+* Calls do not modify the model, so a large batch can be split across threads,
+* each with its own range of queries and nearest.
+*
+* \param self EmlNeighborsModel instance
+* \param features Input data values (n_queries * features_length)
+* \param n_queries Number of input datapoints
+* \param features_length Length of each input datapoint
+* \param k Number of neighbors to find. Must be <= model->n_items
+* \param nearest Array to return the k nearest for each query in (n_queries * k), by ascending distance
+* \param nearest_length Length of nearest array. Must be >= n_queries * k
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_infer_nearest_batch(EmlNeighborsModel *self,
+            const int16_t *features, int n_queries, int features_length,
+            int k,
+            EmlNeighborsDistanceItem *nearest, int nearest_length)
+{
+    EML_PRECONDITION(features_length == self->n_features, EmlSizeMismatch);
+    EML_PRECONDITION(k >= 0 && k <= self->n_items, EmlSizeMismatch);
+    EML_PRECONDITION(n_queries >= 0 && nearest_length >= n_queries * k, EmlSizeMismatch);
+
+    if ((self->tree_nodes && self->tree_n_nodes > 0) || self->feature_order) {
+        for (int q=0; q<n_queries; q++) {
+            EML_CHECK_ERROR(eml_neighbors_infer_nearest(self, features + (q * features_length),
+                        features_length, k, nearest + (q * k), k));
+        }
+        return EmlOk;
+    }
+
+    const int16_t *queries[EML_NEIGHBORS_BATCH_QUERIES];
+    int found[EML_NEIGHBORS_BATCH_QUERIES];
+
+    for (int start=0; start<n_queries; start+=EML_NEIGHBORS_BATCH_QUERIES) {
+        const int remaining = n_queries - start;
+        const int tile = (remaining < EML_NEIGHBORS_BATCH_QUERIES) ? remaining : EML_NEIGHBORS_BATCH_QUERIES;
+
+        for (int q=0; q<tile; q++) {
+            queries[q] = features + ((start + q) * features_length);
+            found[q] = 0;
+        }
+
+        for (int i=0; i<self->n_items; i++) {
+            for (int q=0; q<tile; q++) {
+                EmlNeighborsDistanceItem *heap = nearest + ((start + q) * k);
+                EmlNeighborsDistance limit = (EmlNeighborsDistance)-1;
+#if EML_NEIGHBORS_EARLY_ABANDON
+                if (found[q] == k && k > 0) {
+                    limit = heap[0].distance;
+                }
 #endif
+                EmlNeighborsDistanceItem d;
+                d.index = i;
+                d.distance = eml_neighbors_item_distance(self, queries[q], i, limit);
+                eml_neighbors_topk_push(heap, &found[q], k, d);
+            }
+        }
+
+        for (int q=0; q<tile; q++) {
+            eml_neighbors_topk_sort(nearest + ((start + q) * k), found[q]);
+        }
     }
 
-    int32_t most_voted_class = -1;
-    int32_t most_voted_votes = 0;
-    for (int32_t i=0; i<EML_NEIGHBORS_MAX_CLASSES; i++) {
+    return EmlOk;
+}
+
+/**
+* \brief Convert squared distances into euclidean distances, in-place
+*
+* Ranking only needs squared distances. Use this on the k nearest when the actual distance is needed.
+*/
+static inline void
+eml_neighbors_distances_sqrt(EmlNeighborsDistanceItem *items, int length)
+{
+    for (int i=0; i<length; i++) {
+        items[i].distance = eml_neighbors_isqrt(items[i].distance);
+    }
+}
+
+// Weight of each of the nearest items, according to model->weighting
+// With distance weighting, items at distance 0 get weight 1 and the others 0, like scikit-learn
+static inline float
+eml_neighbors_item_weight(const EmlNeighborsModel *self,
+        EmlNeighborsDistance distance, int exact_match)
+{
+    if (self->weighting != EmlNeighborsWeightDistance) {
+        return 1.0f;
+    }
+    if (exact_match) {
+        return (distance == 0) ? 1.0f : 0.0f;
+    }
+    return 1.0f / sqrtf((float)distance);
+}
+
+static inline int
+eml_neighbors_has_exact_match(const EmlNeighborsDistanceItem *nearest, int n_nearest)
+{
+    // nearest are sorted by ascending distance
+    return (n_nearest > 0 && nearest[0].distance == 0);
+}
+
+static inline int
+eml_neighbors_valid_label(const EmlNeighborsModel *self, int16_t label)
+{
+    return (label >= 0 && (self->n_classes <= 0 || label < self->n_classes));
+}
+
+/**
+* \brief Majority vote among the labels of the nearest items
+*
+* Votes are weighted according to model->weighting. Ties go to the lowest label.
+* Uses no storage per class, so any number of classes is supported,
+* and concurrent calls on the same model are safe.
+*
+* \param self EmlNeighborsModel instance
+* \param nearest The items to vote among, by ascending distance
+* \param n_nearest Number of items in nearest
+* \param out Location to return the most voted class label
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_vote(const EmlNeighborsModel *self,
+        const EmlNeighborsDistanceItem *nearest, int n_nearest,
+        int16_t *out)
+{
+    const int exact = eml_neighbors_has_exact_match(nearest, n_nearest);
+
+    // O(k^2) in the number of nearest items, which is small
+    int16_t most_voted_class = -1;
+    float most_voted_votes = 0.0f;
+    for (int i=0; i<n_nearest; i++) {
+        const int16_t label = self->labels[nearest[i].index];
+        if (!eml_neighbors_valid_label(self, label)) {
+            return EmlUnknownError;
+        }
+
+        int counted = 0;
+        for (int j=0; j<i; j++) {
+            if (self->labels[nearest[j].index] == label) {
+                counted = 1;
+                break;
+            }
+        }
+        if (counted) {
+            continue;
+        }
+
+        float votes = 0.0f;
+        for (int j=i; j<n_nearest; j++) {
+            if (self->labels[nearest[j].index] == label) {
+                votes += eml_neighbors_item_weight(self, nearest[j].distance, exact);
+            }
+        }
 
 #if EML_NEIGHBORS_LOG_LEVEL > 1
-        EML_LOG_BEGIN("eml_neighbors_find_nearest_votes_iter");
-        EML_LOG_ADD_INTEGER("index", i);
-        EML_LOG_ADD_INTEGER("votes", votes[i]);
+        EML_LOG_BEGIN("eml_neighbors_vote_iter");
+        EML_LOG_ADD_INTEGER("label", label);
+        EML_LOG_ADD_INTEGER("distance", (int)nearest[i].distance);
+        EML_LOG_ADD_FLOAT("votes", votes);
         EML_LOG_END();
 #endif
 
-        if (votes[i] > most_voted_votes) {
-            most_voted_class = i;
-            most_voted_votes = votes[i];
+        if (votes > most_voted_votes || (votes == most_voted_votes && label < most_voted_class)) {
+            most_voted_class = label;
+            most_voted_votes = votes;
         }
     }
     *out = most_voted_class;
@@ -247,14 +995,79 @@ eml_neighbors_find_nearest(EmlNeighborsModel *self,
     return EmlOk;
 }
 
+/**
+* \brief Class probabilities from the labels of the nearest items
+*
+* Votes are weighted according to model->weighting, and normalized to sum to 1.
+*
+* \param self EmlNeighborsModel instance
+* \param nearest The items to vote among, by ascending distance
+* \param n_nearest Number of items in nearest
+* \param out Array to return the probability of each class in
+* \param out_length Length of out. Must be at least model->n_classes
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_vote_proba(const EmlNeighborsModel *self,
+        const EmlNeighborsDistanceItem *nearest, int n_nearest,
+        float *out, int out_length)
+{
+    EML_PRECONDITION(out_length >= self->n_classes, EmlSizeMismatch);
+
+    const int exact = eml_neighbors_has_exact_match(nearest, n_nearest);
+
+    for (int i=0; i<out_length; i++) {
+        out[i] = 0.0f;
+    }
+    float total = 0.0f;
+    for (int i=0; i<n_nearest; i++) {
+        const int16_t label = self->labels[nearest[i].index];
+        if (!eml_neighbors_valid_label(self, label) || label >= out_length) {
+            return EmlUnknownError;
+        }
+        const float w = eml_neighbors_item_weight(self, nearest[i].distance, exact);
+        out[label] += w;
+        total += w;
+    }
+    if (total > 0.0f) {
+        for (int i=0; i<out_length; i++) {
+            out[i] /= total;
+        }
+    }
+
+    return EmlOk;
+}
+
+EmlError
+eml_neighbors_find_nearest(EmlNeighborsModel *self,
+        EmlNeighborsDistanceItem *distances, int distances_length,
+        int k, int16_t *out)
+{
+    EML_PRECONDITION(k <= distances_length, EmlSizeMismatch);
+
+#if EML_NEIGHBORS_LOG_LEVEL > 1
+        EML_LOG_BEGIN("eml_neighbors_find_nearest_start");
+        EML_LOG_ADD_INTEGER("distances", distances_length);
+        EML_LOG_ADD_INTEGER("items", distances_length);
+        EML_LOG_ADD_INTEGER("k", k);
+        EML_LOG_END();
+#endif
+
+    // partial argsort by distance. NOTE: reorders in-place
+    EML_CHECK_ERROR(eml_neighbors_select_nearest(distances, distances_length, k));
+
+    return eml_neighbors_vote(self, distances, k, out);
+}
+
 /**
 * \brief Run inference and return most probable class
 *
 * \param self EmlNeighborsModel instance
 * \param features Input data values
 * \param features_length Length of input data
-* \param distances Array to use for storing distances
-* \param distances_length Length of distance array. Must be larger than model->n_items
+* \param distances Array to use for storing the nearest items
+* \param distances_length Length of distance array. Must be at least model->k_neighbors
 * \param out Location to return predicted class label
 *
 * \return EmlOk on success, or -EmlError on failure
@@ -265,18 +1078,18 @@ eml_neighbors_predict(EmlNeighborsModel *self,
         EmlNeighborsDistanceItem *distances, int distances_length,
         int16_t *out)
 {
-    // NOTE: Preconditions checked inside _infer()
-    // Compute distances
+    // NOTE: Preconditions checked inside _infer_nearest()
+    // Compute distances, keeping only the k nearest
+    const int k = self->k_neighbors;
     const EmlError infer_err = \
-        eml_neighbors_infer(self, features, features_length, distances, distances_length);
+        eml_neighbors_infer_nearest(self, features, features_length, k, distances, distances_length);
     if (infer_err != EmlOk) {
         return infer_err;
     }
 
     // Find kNN predictions 
     int16_t label = -1;
-    EmlError find_err = \
-        eml_neighbors_find_nearest(self, distances, self->n_items, self->k_neighbors, &label);
+    EmlError find_err = eml_neighbors_vote(self, distances, k, &label);
     if (find_err != EmlOk) {
         return find_err;
     }
@@ -285,3 +1098,347 @@ eml_neighbors_predict(EmlNeighborsModel *self,
     return EmlOk;
 }
 
+/**
+* \brief Run inference and return the probability of each class
+*
+* \param self EmlNeighborsModel instance
+* \param features Input data values
+* \param features_length Length of input data
+* \param distances Array to use for storing the nearest items
+* \param distances_length Length of distance array. Must be at least model->k_neighbors
+* \param out Array to return the class probabilities in
+* \param out_length Length of out. Must be at least model->n_classes
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_predict_proba(EmlNeighborsModel *self,
+        const int16_t *features, int features_length,
+        EmlNeighborsDistanceItem *distances, int distances_length,
+        float *out, int out_length)
+{
+    const int k = self->k_neighbors;
+    EML_CHECK_ERROR(eml_neighbors_infer_nearest(self, features, features_length, k, distances, distances_length));
+
+    return eml_neighbors_vote_proba(self, distances, k, out, out_length);
+}
+
+/**
+* \brief Run inference and return the average label of the k nearest items
+*
+* kNN regression. The labels are used as the (integer) target values,
+* and averaged according to model->weighting.
+*
+* \param self EmlNeighborsModel instance
+* \param features Input data values
+* \param features_length Length of input data
+* \param distances Array to use for storing the nearest items
+* \param distances_length Length of distance array. Must be at least model->k_neighbors
+* \param out Location to return the predicted value
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_regress(EmlNeighborsModel *self,
+        const int16_t *features, int features_length,
+        EmlNeighborsDistanceItem *distances, int distances_length,
+        float *out)
+{
+    const int k = self->k_neighbors;
+    EML_CHECK_ERROR(eml_neighbors_infer_nearest(self, features, features_length, k, distances, distances_length));
+
+    const int exact = eml_neighbors_has_exact_match(distances, k);
+    float sum = 0.0f;
+    float total = 0.0f;
+    for (int i=0; i<k; i++) {
+        const float w = eml_neighbors_item_weight(self, distances[i].distance, exact);
+        sum += w * (float)self->labels[distances[i].index];
+        total += w;
+    }
+    *out = (total > 0.0f) ? (sum / total) : 0.0f;
+
+    return EmlOk;
+}
+
+/**
+* \brief Run inference and return the distance to the k-th nearest item
+*
+* Can be used as an outlier / anomaly score: larger means further away from the known data.
+* The same value is available without an extra pass after eml_neighbors_predict(),
+* as the square root of distances[k-1].distance
+*
+* \param self EmlNeighborsModel instance
+* \param features Input data values
+* \param features_length Length of input data
+* \param distances Array to use for storing the nearest items
+* \param distances_length Length of distance array. Must be at least model->k_neighbors
+* \param out Location to return the euclidean distance
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_outlier_score(EmlNeighborsModel *self,
+        const int16_t *features, int features_length,
+        EmlNeighborsDistanceItem *distances, int distances_length,
+        float *out)
+{
+    const int k = self->k_neighbors;
+    EML_PRECONDITION(k > 0, EmlUninitialized);
+    EML_CHECK_ERROR(eml_neighbors_infer_nearest(self, features, features_length, k, distances, distances_length));
+
+    *out = sqrtf((float)distances[k-1].distance);
+
+    return EmlOk;
+}
+
+/**
+* \brief Run inference on multiple input datapoints, returning the most probable class for each
+*
+* See eml_neighbors_infer_nearest_batch()
+*
+* \param self EmlNeighborsModel instance
+* \param features Input data values (n_queries * features_length)
+* \param n_queries Number of input datapoints
+* \param features_length Length of each input datapoint
+* \param distances Array to use for storing the nearest items. Must be at least n_queries * model->k_neighbors
+* \param distances_length Length of distance array
+* \param out Array to return the predicted class labels in
+* \param out_length Length of out. Must be at least n_queries
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_predict_batch(EmlNeighborsModel *self,
+        const int16_t *features, int n_queries, int features_length,
+        EmlNeighborsDistanceItem *distances, int distances_length,
+        int16_t *out, int out_length)
+{
+    EML_PRECONDITION(out_length >= n_queries, EmlSizeMismatch);
+
+    const int k = self->k_neighbors;
+    EML_CHECK_ERROR(eml_neighbors_infer_nearest_batch(self, features, n_queries, features_length,
+                k, distances, distances_length));
+
+    for (int q=0; q<n_queries; q++) {
+        EML_CHECK_ERROR(eml_neighbors_vote(self, distances + (q * k), k, &out[q]));
+    }
+
+    return EmlOk;
+}
+
+
+/**
+* \brief Remove an item from the model
+*
+* The last item is moved into its place, so this is O(1), but changes the index of that item.
+* Items covered by the KD-tree index cannot be removed.
+*
+* \param self EmlNeighborsModel instance
+* \param index The item to remove. Must be in [tree_items, n_items)
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_remove_item(EmlNeighborsModel *self, int index)
+{
+    const int first = (self->tree_nodes) ? self->tree_items : 0;
+    EML_PRECONDITION(index >= first && index < self->n_items, EmlSizeMismatch);
+
+    const int last = self->n_items - 1;
+    if (index != last) {
+        const int n_features = self->n_features;
+        if (self->compressed) {
+            int8_t *codes = self->compressed->codes;
+            memcpy(codes + (n_features * index), codes + (n_features * last), sizeof(int8_t)*n_features);
+        } else {
+            memcpy(self->data + (n_features * index), self->data + (n_features * last), sizeof(int16_t)*n_features);
+        }
+        self->labels[index] = self->labels[last];
+    }
+    self->n_items -= 1;
+
+    return EmlOk;
+}
+
+/**
+* \brief Add a datapoint, replacing the oldest added item when the model is full
+*
+* Items covered by the KD-tree index are kept, the others are used as a ring buffer. O(1)
+*
+* \param self EmlNeighborsModel instance
+* \param values Feature values for this datapoint
+* \param values_length Length of feature data. Must equal model->n_features
+* \param label The label to associate with this datapoint
+* \param out_index Location to return the index the item was stored at. Can be NULL
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_add_item_fifo(EmlNeighborsModel *self,
+        const int16_t *values, int16_t values_length,
+        int16_t label, int16_t *out_index)
+{
+    EML_PRECONDITION(values_length == self->n_features, EmlSizeMismatch);
+
+    int index = self->n_items;
+    if (self->n_items < self->max_items) {
+        self->n_items += 1;
+    } else {
+        const int first = (self->tree_nodes) ? self->tree_items : 0;
+        const int capacity = self->max_items - first;
+        EML_PRECONDITION(capacity > 0, EmlSizeMismatch);
+        if (self->replace_next < 0 || self->replace_next >= capacity) {
+            self->replace_next = 0;
+        }
+        index = first + self->replace_next;
+        self->replace_next += 1;
+    }
+    eml_neighbors_store_item(self, index, values, label);
+
+    if (out_index) {
+        *out_index = index;
+    }
+    return EmlOk;
+}
+
+/**
+* \brief Add a datapoint, keeping a uniform random sample of all items offered when the model is full
+*
+* Reservoir sampling (Algorithm R) over the items not covered by the KD-tree index. O(1)
+*
+* \param self EmlNeighborsModel instance
+* \param values Feature values for this datapoint
+* \param values_length Length of feature data. Must equal model->n_features
+* \param label The label to associate with this datapoint
+* \param random A uniformly distributed random number, provided by the caller
+* \param out_index Location to return the index the item was stored at, or -1 if it was not stored. Can be NULL
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_add_item_reservoir(EmlNeighborsModel *self,
+        const int16_t *values, int16_t values_length,
+        int16_t label, uint32_t random, int16_t *out_index)
+{
+    EML_PRECONDITION(values_length == self->n_features, EmlSizeMismatch);
+
+    const int first = (self->tree_nodes) ? self->tree_items : 0;
+    const int capacity = self->max_items - first;
+    EML_PRECONDITION(capacity > 0, EmlSizeMismatch);
+
+    // items present from before count as seen
+    const uint32_t n_present = (uint32_t)(self->n_items - first);
+    if (self->n_seen < n_present) {
+        self->n_seen = n_present;
+    }
+    self->n_seen += 1;
+
+    int index = -1;
+    if (self->n_items < self->max_items) {
+        index = self->n_items;
+        self->n_items += 1;
+    } else {
+        const uint32_t j = random % self->n_seen;
+        if (j < (uint32_t)capacity) {
+            index = first + (int)j;
+        }
+    }
+    if (index >= 0) {
+        eml_neighbors_store_item(self, index, values, label);
+    }
+
+    if (out_index) {
+        *out_index = index;
+    }
+    return EmlOk;
+}
+
+/**
+* \brief Merge a datapoint into its nearest item, if that is a near-duplicate with the same label
+*
+* The merged item is moved to the midpoint of the two.
+* If the near-duplicate is covered by the KD-tree index, it is left unchanged,
+* and the datapoint is considered already represented. O(n_items)
+*
+* \param self EmlNeighborsModel instance
+* \param values Feature values for this datapoint
+* \param values_length Length of feature data. Must equal model->n_features
+* \param label The label to associate with this datapoint
+* \param max_distance Largest squared distance to consider a near-duplicate
+* \param out_index Location to return the index of the near-duplicate, or -1 if there was none
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_merge_item(EmlNeighborsModel *self,
+        const int16_t *values, int16_t values_length,
+        int16_t label, EmlNeighborsDistance max_distance, int16_t *out_index)
+{
+    EML_PRECONDITION(values_length == self->n_features, EmlSizeMismatch);
+    EML_PRECONDITION(values_length <= EML_NEIGHBORS_MAX_FEATURES, EmlUnsupported);
+    EML_PRECONDITION(out_index, EmlUninitialized);
+
+    *out_index = -1;
+    if (self->n_items < 1) {
+        return EmlOk;
+    }
+
+    EmlNeighborsDistanceItem nearest;
+    EML_CHECK_ERROR(eml_neighbors_infer_nearest(self, values, values_length, 1, &nearest, 1));
+    if (nearest.distance > max_distance || self->labels[nearest.index] != label) {
+        return EmlOk;
+    }
+
+    const int first = (self->tree_nodes) ? self->tree_items : 0;
+    if (nearest.index >= first) {
+        int16_t merged[EML_NEIGHBORS_MAX_FEATURES];
+        eml_neighbors_load_item(self, nearest.index, merged);
+        for (int i=0; i<values_length; i++) {
+            merged[i] = (int16_t)(((int32_t)merged[i] + (int32_t)values[i]) / 2);
+        }
+        eml_neighbors_store_item(self, nearest.index, merged, label);
+    }
+    *out_index = nearest.index;
+
+    return EmlOk;
+}
+
+/**
+* \brief Add a datapoint only if the current items misclassify it
+*
+* Online condensed nearest neighbor (IB2): correctly classified datapoints are redundant,
+* so the model keeps mostly items near the decision boundaries.
+* Stored with eml_neighbors_add_item_fifo() when the model is full. O(n_items)
+*
+* \param self EmlNeighborsModel instance
+* \param values Feature values for this datapoint
+* \param values_length Length of feature data. Must equal model->n_features
+* \param label The label to associate with this datapoint
+* \param distances Array to use for storing the nearest items
+* \param distances_length Length of distance array. Must be at least model->k_neighbors
+* \param out_index Location to return the index the item was stored at, or -1 if it was not stored. Can be NULL
+*
+* \return EmlOk on success, or -EmlError on failure
+*/
+EmlError
+eml_neighbors_add_item_condensed(EmlNeighborsModel *self,
+        const int16_t *values, int16_t values_length,
+        int16_t label,
+        EmlNeighborsDistanceItem *distances, int distances_length,
+        int16_t *out_index)
+{
+    if (out_index) {
+        *out_index = -1;
+    }
+
+    if (self->n_items >= self->k_neighbors && self->n_items > 0) {
+        int16_t predicted = -1;
+        EML_CHECK_ERROR(eml_neighbors_predict(self, values, values_length,
+                    distances, distances_length, &predicted));
+        if (predicted == label) {
+            return EmlOk;
+        }
+    }
+
+    return eml_neighbors_add_item_fifo(self, values, values_length, label, out_index);
+}
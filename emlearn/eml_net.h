@@ -2,12 +2,34 @@
 #ifndef EML_NET_H
 #define EML_NET_H
 
+// Configuration options
+#ifndef EML_NET_LOG_LEVEL
+#define EML_NET_LOG_LEVEL 0
+#endif
+
+// Collect per-layer timing and cost counters during inference. Default OFF
+#ifndef EML_NET_PROFILE
+#define EML_NET_PROFILE 0
+#endif
+
 #include "eml_common.h"
 #include "eml_net_common.h"
 
+#if EML_NET_PROFILE
+#ifndef EML_NET_PROFILE_MICROS
+#include "eml_benchmark.h"
+#define EML_NET_PROFILE_MICROS() eml_benchmark_micros()
+#endif
+#endif
+
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -17,9 +39,23 @@ extern "C" {
 // TODO: implement HardSigmoid
 
 
+/**
+    Storage type for the weights of a layer
+*/
+typedef enum _EmlNetWeightType {
+    EmlNetWeightFloat32 = 0,
+    EmlNetWeightFloat16,
+    EmlNetWeightBFloat16,
+    EmlNetWeightTypes,
+} EmlNetWeightType;
+
 /** @struct EmlNetLayer
 *  Layer of a Neural Network
 *
+* The weights are either stored as float (weights),
+* or as 16 bit half-precision values (weights_compact), as given by weights_type.
+* The compact weights are widened to float during inference.
+*
 * \internal
 */
 typedef struct _EmlNetLayer {
@@ -28,6 +64,8 @@ typedef struct _EmlNetLayer {
     const float *weights;
     const float *biases;
     EmlNetActivationFunction activation;
+    EmlNetWeightType weights_type;
+    const uint16_t *weights_compact;
 } EmlNetLayer;
 
 /** @typedef EmlNet
@@ -46,6 +84,122 @@ typedef struct _EmlNet {
     int32_t activations_length;
 } EmlNet;
 
+/** @typedef EmlNetContext
+* \brief Scratch buffers for running inference
+*
+* Holds the mutable state used during inference, separate from the (immutable) EmlNet.
+* By giving each thread its own EmlNetContext, a single EmlNet can be used concurrently.
+* The buffers must have at least eml_net_context_length() elements each.
+*/
+typedef struct _EmlNetContext {
+    float *activations1;
+    float *activations2;
+    int32_t activations_length;
+    // Optional per-layer counters, filled in when EML_NET_PROFILE is enabled
+    struct _EmlNetLayerStats *stats;
+    int32_t stats_length;
+} EmlNetContext;
+
+/** @typedef EmlNetLayerStats
+* \brief Profiling counters for one layer
+*
+* Accumulated over all inference calls, until reset with eml_net_layer_stats_reset().
+* Only updated when compiled with EML_NET_PROFILE=1.
+*/
+typedef struct _EmlNetLayerStats {
+    int32_t calls;
+    int64_t time_us;
+    int64_t macs; // multiply-accumulate operations
+    int64_t weight_bytes; // weights and biases read
+    int64_t activation_bytes; // inputs read and outputs written
+} EmlNetLayerStats;
+
+
+/*
+* \internal
+* \brief Convert IEEE 754 half-precision (binary16) to float
+*
+* Uses the F16C instructions on x86, and native __fp16 on ARM when available.
+*/
+static inline float
+eml_net_float16_to_float(uint16_t h)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#elif defined(__ARM_FP16_FORMAT_IEEE)
+    __fp16 f;
+    memcpy(&f, &h, sizeof(f));
+    return (float)f;
+#else
+    const uint32_t sign = ((uint32_t)(h & 0x8000)) << 16;
+    uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t mantissa = h & 0x3FF;
+    uint32_t bits;
+
+    if (exponent == 0x1F) {
+        // inf or NaN
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        // normal number
+        bits = sign | ((exponent + (127 - 15)) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        // signed zero
+        bits = sign;
+    } else {
+        // subnormal, normalize it
+        exponent = 127 - 15 + 1;
+        while ((mantissa & 0x400) == 0) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+
+    float out;
+    memcpy(&out, &bits, sizeof(out));
+    return out;
+#endif
+}
+
+/*
+* \internal
+* \brief Convert bfloat16 to float
+*/
+static inline float
+eml_net_bfloat16_to_float(uint16_t h)
+{
+    const uint32_t bits = ((uint32_t)h) << 16;
+    float out;
+    memcpy(&out, &bits, sizeof(out));
+    return out;
+}
+
+/*
+* \internal
+* \brief Widen an array of compact weights to float
+*/
+static void
+eml_net_widen(const uint16_t *in, EmlNetWeightType type, float *out, int32_t length)
+{
+    int32_t i = 0;
+
+    if (type == EmlNetWeightBFloat16) {
+        for (; i<length; i++) {
+            out[i] = eml_net_bfloat16_to_float(in[i]);
+        }
+        return;
+    }
+
+#if defined(__F16C__)
+    for (; i+8<=length; i+=8) {
+        const __m128i h = _mm_loadu_si128((const __m128i *)(in+i));
+        _mm256_storeu_ps(out+i, _mm256_cvtph_ps(h));
+    }
+#endif
+    for (; i<length; i++) {
+        out[i] = eml_net_float16_to_float(in[i]);
+    }
+}
 
 static float
 eml_net_relu(float in) {
@@ -103,19 +257,25 @@ eml_net_argmax(const float *values, int32_t values_length) {
 
 
 static bool
-eml_net_valid(EmlNet *model) {
+eml_net_valid(const EmlNet *model) {
     bool not_null = model->layers && model->activations1 && model->activations2;
     return not_null;
 }
 
+static bool
+eml_net_context_valid(const EmlNetContext *ctx) {
+    bool not_null = ctx->activations1 && ctx->activations2;
+    return not_null;
+}
+
 static inline int32_t
-eml_net_outputs(EmlNet *model) {
+eml_net_outputs(const EmlNet *model) {
     return model->layers[model->n_layers-1].n_outputs;
 }
 
 // For binary problem, one output, we need to report [ prob(class_0), prob(class_1)]
 static inline int32_t
-eml_net_outputs_proba(EmlNet *model) {
+eml_net_outputs_proba(const EmlNet *model) {
     int32_t n_outputs = eml_net_outputs(model);
     if (n_outputs == 1) {
         n_outputs = 2;
@@ -129,7 +289,7 @@ eml_net_outputs_proba(EmlNet *model) {
 * 
 */
 static int32_t
-eml_net_find_largest_layer(EmlNet *model) {
+eml_net_find_largest_layer(const EmlNet *model) {
     int32_t largest = -1;
     for (int i=0; i<model->n_layers; i++) {
         if (model->layers[i].n_inputs > largest) {
@@ -142,6 +302,81 @@ eml_net_find_largest_layer(EmlNet *model) {
     return largest;
 }
 
+/**
+* \brief Required length of each of the EmlNetContext activation buffers
+*
+* \param model EmlNet instance
+*
+* \return Number of elements needed in each buffer
+*/
+static inline int32_t
+eml_net_context_length(const EmlNet *model) {
+    return eml_net_find_largest_layer(model);
+}
+
+/*
+* \internal
+* \brief Context using the buffers stored in the model
+*/
+static inline EmlNetContext
+eml_net_model_context(const EmlNet *model) {
+    const EmlNetContext ctx = { model->activations1, model->activations2, model->activations_length, NULL, 0 };
+    return ctx;
+}
+
+/**
+* \brief Number of multiply-accumulate operations for one inference of layer
+*/
+static inline int64_t
+eml_net_layer_macs(const EmlNetLayer *layer) {
+    return (int64_t)layer->n_inputs * layer->n_outputs;
+}
+
+/**
+* \brief Number of bytes of weights and biases read for one inference of layer
+*/
+static inline int64_t
+eml_net_layer_weight_bytes(const EmlNetLayer *layer) {
+    const int64_t weight_size = (layer->weights_type == EmlNetWeightFloat32) ? sizeof(float) : sizeof(uint16_t);
+    return (eml_net_layer_macs(layer) * weight_size) + ((int64_t)layer->n_outputs * sizeof(float));
+}
+
+/**
+* \brief Number of bytes of activations read and written for one inference of layer
+*/
+static inline int64_t
+eml_net_layer_activation_bytes(const EmlNetLayer *layer) {
+    return ((int64_t)layer->n_inputs + layer->n_outputs) * sizeof(float);
+}
+
+/**
+* \brief Clear profiling counters
+*/
+void
+eml_net_layer_stats_reset(EmlNetLayerStats *stats, int32_t length) {
+    memset(stats, 0, sizeof(EmlNetLayerStats)*length);
+}
+
+/**
+* \brief Log the profiling counters, one logfmt entry per layer
+*
+* Requires logging to be enabled, see eml_log.h
+*/
+void
+eml_net_layer_stats_log(const EmlNetLayerStats *stats, int32_t length) {
+    for (int l=0; l<length; l++) {
+        EML_LOG_BEGIN("eml-net-layer-stats");
+        EML_LOG_ADD_INTEGER("layer", l);
+        EML_LOG_ADD_INTEGER("calls", (int)stats[l].calls);
+        EML_LOG_ADD_INTEGER64("time_us", stats[l].time_us);
+        EML_LOG_ADD_INTEGER64("macs", stats[l].macs);
+        EML_LOG_ADD_INTEGER64("weight_bytes", stats[l].weight_bytes);
+        EML_LOG_ADD_INTEGER64("activation_bytes", stats[l].activation_bytes);
+        EML_LOG_END();
+    }
+    (void)stats; // unused when logging is disabled
+}
+
 
 // CMSIS-NN tricks
 // - fixed-point math
@@ -169,27 +404,10 @@ eml_net_find_largest_layer(EmlNet *model) {
 // reached state-of-art in MINST/CIFAR-10 with linear SVM classifier
 // scattering transform also did well
 
-// Inference for a single layer
-EmlError
-eml_net_forward(const float *in, int32_t in_length,
-                const float *weights,
-                const float *biases,
-                EmlNetActivationFunction activation,
-                float *out, int32_t out_length)
+// Apply activation function, in-place
+static EmlError
+eml_net_activate(float *out, int32_t out_length, EmlNetActivationFunction activation)
 {
-
-    // multiply inputs by weights
-    for (int o=0; o<out_length; o++) {
-        float sum = 0.0f;
-        for (int i=0; i<in_length; i++) {
-            const int w_idx = o+(i*out_length);
-            const float w = weights[w_idx];
-            sum += w * in[i];
-        }
-        out[o] = sum + biases[o];
-    }
-
-    // apply activation function
     if (activation == EmlNetActivationIdentity) {
         // no-op
     } else if (activation == EmlNetActivationRelu) {
@@ -216,6 +434,69 @@ eml_net_forward(const float *in, int32_t in_length,
     return EmlOk;
 }
 
+// Inference for a single layer
+EmlError
+eml_net_forward(const float *in, int32_t in_length,
+                const float *weights,
+                const float *biases,
+                EmlNetActivationFunction activation,
+                float *out, int32_t out_length)
+{
+
+    // multiply inputs by weights
+    for (int o=0; o<out_length; o++) {
+        float sum = 0.0f;
+        for (int i=0; i<in_length; i++) {
+            const int w_idx = o+(i*out_length);
+            const float w = weights[w_idx];
+            sum += w * in[i];
+        }
+        out[o] = sum + biases[o];
+    }
+
+    return eml_net_activate(out, out_length, activation);
+}
+
+#ifndef EML_NET_WIDEN_BLOCK
+#define EML_NET_WIDEN_BLOCK 32
+#endif
+
+// Inference for a single layer, with weights stored as float16/bfloat16
+EmlError
+eml_net_forward_compact(const float *in, int32_t in_length,
+                const uint16_t *weights,
+                EmlNetWeightType weights_type,
+                const float *biases,
+                EmlNetActivationFunction activation,
+                float *out, int32_t out_length)
+{
+    EML_PRECONDITION(weights_type == EmlNetWeightFloat16 || \
+                    weights_type == EmlNetWeightBFloat16, EmlUnsupported);
+
+    for (int o=0; o<out_length; o++) {
+        out[o] = biases[o];
+    }
+
+    // Weights for one input are contiguous over the outputs.
+    // Widen them a block at a time, and accumulate into the outputs
+    float widened[EML_NET_WIDEN_BLOCK];
+    for (int i=0; i<in_length; i++) {
+        const uint16_t *row = weights + (i*out_length);
+        const float x = in[i];
+
+        for (int start=0; start<out_length; start+=EML_NET_WIDEN_BLOCK) {
+            const int32_t remaining = out_length - start;
+            const int32_t n = (remaining < EML_NET_WIDEN_BLOCK) ? remaining : EML_NET_WIDEN_BLOCK;
+            eml_net_widen(row+start, weights_type, widened, n);
+            for (int j=0; j<n; j++) {
+                out[start+j] += widened[j] * x;
+            }
+        }
+    }
+
+    return eml_net_activate(out, out_length, activation);
+}
+
 
 EmlError
 eml_net_layer_forward(const EmlNetLayer *layer,
@@ -224,9 +505,20 @@ eml_net_layer_forward(const EmlNetLayer *layer,
 {
     EML_PRECONDITION(in_length >= layer->n_inputs, EmlSizeMismatch);
     EML_PRECONDITION(out_length >= layer->n_outputs, EmlSizeMismatch);
-    EML_PRECONDITION(layer->weights, EmlUninitialized);
     EML_PRECONDITION(layer->biases, EmlUninitialized);
 
+    if (layer->weights_type != EmlNetWeightFloat32) {
+        EML_PRECONDITION(layer->weights_compact, EmlUninitialized);
+        return eml_net_forward_compact(in, layer->n_inputs,
+                layer->weights_compact,
+                layer->weights_type,
+                layer->biases,
+                layer->activation,
+                out, layer->n_outputs
+        );
+    }
+
+    EML_PRECONDITION(layer->weights, EmlUninitialized);
     const EmlError err = eml_net_forward(in, layer->n_inputs,
             layer->weights,
             layer->biases,
@@ -240,48 +532,115 @@ eml_net_layer_forward(const EmlNetLayer *layer,
 
 /*
 * \internal
-* \brief Run inference
-* 
-* Used internally by eml_net_predict et.c.
-* NOTE: Leaves results in activations2
+* \brief Run a layer as part of inference, collecting profiling data if enabled
+*/
+static EmlError
+eml_net_context_layer_forward(EmlNetContext *ctx, int32_t layer_no,
+                    const EmlNetLayer *layer,
+                    const float *in, int32_t in_length,
+                    float *out, int32_t out_length)
+{
+#if EML_NET_PROFILE
+    const int64_t start = EML_NET_PROFILE_MICROS();
+    const EmlError err = eml_net_layer_forward(layer, in, in_length, out, out_length);
+    const int64_t duration = EML_NET_PROFILE_MICROS() - start;
+
+    if (ctx->stats && layer_no < ctx->stats_length) {
+        EmlNetLayerStats *stats = &ctx->stats[layer_no];
+        stats->calls += 1;
+        stats->time_us += duration;
+        stats->macs += eml_net_layer_macs(layer);
+        stats->weight_bytes += eml_net_layer_weight_bytes(layer);
+        stats->activation_bytes += eml_net_layer_activation_bytes(layer);
+    }
+
+#if EML_NET_LOG_LEVEL > 1
+    EML_LOG_BEGIN("eml-net-layer");
+    EML_LOG_ADD_INTEGER("layer", layer_no);
+    EML_LOG_ADD_INTEGER64("time_us", duration);
+    EML_LOG_ADD_INTEGER64("macs", eml_net_layer_macs(layer));
+    EML_LOG_ADD_INTEGER64("weight_bytes", eml_net_layer_weight_bytes(layer));
+    EML_LOG_ADD_INTEGER64("activation_bytes", eml_net_layer_activation_bytes(layer));
+    EML_LOG_END();
+#endif
+
+    return err;
+#else
+    (void)ctx;
+    (void)layer_no;
+    return eml_net_layer_forward(layer, in, in_length, out, out_length);
+#endif
+}
+
+/*
+* \internal
+* \brief Run inference, using the scratch buffers in ctx
+*
+* Used internally by eml_net_context_predict et.c.
+* The model is not modified, so it can be shared between concurrent callers
+* as long as each uses its own context.
+* NOTE: Leaves results in ctx->activations2
 */
 EmlError
-eml_net_infer(EmlNet *model, const float *features, int32_t features_length)
+eml_net_context_infer(const EmlNet *model, EmlNetContext *ctx,
+                    const float *features, int32_t features_length)
 {
-    EML_PRECONDITION(eml_net_valid(model), EmlUninitialized);
+    EML_PRECONDITION(model->layers, EmlUninitialized);
+    EML_PRECONDITION(eml_net_context_valid(ctx), EmlUninitialized);
     EML_PRECONDITION(model->n_layers >= 2, EmlUnsupported);
     EML_PRECONDITION(features_length == model->layers[0].n_inputs, EmlSizeMismatch);
-    EML_PRECONDITION(model->activations_length >= eml_net_find_largest_layer(model), EmlSizeMismatch);
+    EML_PRECONDITION(ctx->activations_length >= eml_net_find_largest_layer(model), EmlSizeMismatch);
 
-    const int32_t buffer_length = model->activations_length; 
-    float *buffer1 = model->activations1;
-    float *buffer2 = model->activations2;
+    const int32_t buffer_length = ctx->activations_length; 
+    float *buffer1 = ctx->activations1;
+    float *buffer2 = ctx->activations2;
 
     // Input layer
-    EML_CHECK_ERROR(eml_net_layer_forward(&model->layers[0], features,
+    EML_CHECK_ERROR(eml_net_context_layer_forward(ctx, 0, &model->layers[0], features,
                         features_length, buffer1, buffer_length));
 
     // Hidden layers
     for (int l=1; l<model->n_layers-1; l++) {
         const EmlNetLayer *layer = &model->layers[l];
         // PERF: avoid copying, swap buffers instead
-        EML_CHECK_ERROR(eml_net_layer_forward(layer, buffer1, buffer_length, buffer2, buffer_length));
+        EML_CHECK_ERROR(eml_net_context_layer_forward(ctx, l, layer,
+                            buffer1, buffer_length, buffer2, buffer_length));
         for (int i=0; i<buffer_length; i++) {
             buffer1[i] = buffer2[i];
         }
     }
 
     // Output layer
-    EML_CHECK_ERROR(eml_net_layer_forward(&model->layers[model->n_layers-1],
+    const int32_t last = model->n_layers-1;
+    EML_CHECK_ERROR(eml_net_context_layer_forward(ctx, last, &model->layers[last],
                         buffer1, buffer_length, buffer2, buffer_length));
 
     return EmlOk;
 }
 
+/*
+* \internal
+* \brief Run inference
+* 
+* Used internally by eml_net_predict et.c.
+* NOTE: Leaves results in activations2
+*/
+EmlError
+eml_net_infer(EmlNet *model, const float *features, int32_t features_length)
+{
+    EML_PRECONDITION(eml_net_valid(model), EmlUninitialized);
+
+    EmlNetContext ctx = eml_net_model_context(model);
+    return eml_net_context_infer(model, &ctx, features, features_length);
+}
+
 /**
-* \brief Run inference and return probabilities. Sum of outputs must be approx. 1.
+* \brief Run inference and return probabilities, using the scratch buffers in ctx
+*
+* Safe to call concurrently on the same model, as long as each caller has its own context.
 *
 * \param model EmlNet instance
+* \param ctx EmlNetContext with buffers for this call
 * \param features Input data values
 * \param features_length Length of input data
 * \param out Buffer to store output
@@ -290,26 +649,27 @@ eml_net_infer(EmlNet *model, const float *features, int32_t features_length)
 * \return EmlOk on success, else an error
 */
 EmlError
-eml_net_predict_proba(EmlNet *model, const float *features, int32_t features_length,
-                                  float *out, int32_t out_length)
+eml_net_context_predict_proba(const EmlNet *model, EmlNetContext *ctx,
+                    const float *features, int32_t features_length,
+                    float *out, int32_t out_length)
 {
-    EML_PRECONDITION(eml_net_valid(model), EmlUninitialized);
+    EML_PRECONDITION(model->layers, EmlUninitialized);
     EML_PRECONDITION(features, EmlUninitialized);
     EML_PRECONDITION(out, EmlUninitialized);
     const int32_t n_outputs = eml_net_outputs_proba(model);
     EML_PRECONDITION(out_length == n_outputs, EmlSizeMismatch);
 
-    EML_CHECK_ERROR(eml_net_infer(model, features, features_length));
+    EML_CHECK_ERROR(eml_net_context_infer(model, ctx, features, features_length));
 
     float proba_sum = 0.0f;
 
     if (n_outputs == 2) {
-        out[1] = model->activations2[0];
+        out[1] = ctx->activations2[0];
         out[0] = 1.0f - out[1];
         proba_sum = out[0] + out[1];
     } else {
         for (int i=0; i<n_outputs; i++) {
-            const float p = model->activations2[i];
+            const float p = ctx->activations2[i];
             out[i] = p;
             proba_sum += p; 
         }
@@ -320,20 +680,44 @@ eml_net_predict_proba(EmlNet *model, const float *features, int32_t features_len
     return EmlOk;
 }
 
+/**
+* \brief Run inference and return probabilities. Sum of outputs must be approx. 1.
+*
+* \param model EmlNet instance
+* \param features Input data values
+* \param features_length Length of input data
+* \param out Buffer to store output
+* \param out_length Length of output buffer
+*
+* \return EmlOk on success, else an error
+*/
+EmlError
+eml_net_predict_proba(EmlNet *model, const float *features, int32_t features_length,
+                                  float *out, int32_t out_length)
+{
+    EML_PRECONDITION(eml_net_valid(model), EmlUninitialized);
+
+    EmlNetContext ctx = eml_net_model_context(model);
+    return eml_net_context_predict_proba(model, &ctx, features, features_length, out, out_length);
+}
 
 /**
-* \brief Run inference and return most probable class
+* \brief Run inference and return most probable class, using the scratch buffers in ctx
+*
+* Safe to call concurrently on the same model, as long as each caller has its own context.
 *
 * \param model EmlNet instance
+* \param ctx EmlNetContext with buffers for this call
 * \param features Input data values
 * \param features_length Length of input data
 *
 * \return The class number, or -EmlError on failure
 */
 int32_t
-eml_net_predict(EmlNet *model, const float *features, int32_t features_length) {
-
-    const EmlError error = eml_net_infer(model, features, features_length);
+eml_net_context_predict(const EmlNet *model, EmlNetContext *ctx,
+                    const float *features, int32_t features_length)
+{
+    const EmlError error = eml_net_context_infer(model, ctx, features, features_length);
     if (error != EmlOk) {
         return -error;
     }
@@ -342,18 +726,41 @@ eml_net_predict(EmlNet *model, const float *features, int32_t features_length) {
 
     int32_t _class = -EmlUnknownError;
     if (n_outputs == 1) {
-        _class = (model->activations2[0] > 0.5f) ? 1 : 0;
+        _class = (ctx->activations2[0] > 0.5f) ? 1 : 0;
     } else if (n_outputs > 1) {
-        _class = eml_net_argmax(model->activations2, n_outputs);
+        _class = eml_net_argmax(ctx->activations2, n_outputs);
     }
 
     return _class;
 }
 
 /**
-* \brief Run inference and return the predicted float array (last layer).
+* \brief Run inference and return most probable class
+*
+* \param model EmlNet instance
+* \param features Input data values
+* \param features_length Length of input data
+*
+* \return The class number, or -EmlError on failure
+*/
+int32_t
+eml_net_predict(EmlNet *model, const float *features, int32_t features_length) {
+
+    if (!eml_net_valid(model)) {
+        return -EmlUninitialized;
+    }
+
+    EmlNetContext ctx = eml_net_model_context(model);
+    return eml_net_context_predict(model, &ctx, features, features_length);
+}
+
+/**
+* \brief Run inference and return the predicted float array (last layer), using the scratch buffers in ctx
+*
+* Safe to call concurrently on the same model, as long as each caller has its own context.
 *
 * \param model EmlNet instance
+* \param ctx EmlNetContext with buffers for this call
 * \param features Input data values
 * \param features_length Length of input data
 * \param out Buffer to store output
@@ -362,22 +769,44 @@ eml_net_predict(EmlNet *model, const float *features, int32_t features_length) {
 * \return EmlOk on success, or error on failure
 */
 EmlError
-eml_net_regress(EmlNet *model, const float *features, int32_t features_length, float *out, int32_t out_length)
+eml_net_context_regress(const EmlNet *model, EmlNetContext *ctx,
+                    const float *features, int32_t features_length,
+                    float *out, int32_t out_length)
 {
     EML_PRECONDITION(out, EmlUninitialized);
     const int32_t n_outputs = eml_net_outputs(model);
     EML_PRECONDITION(out_length == n_outputs, EmlSizeMismatch);
-    EML_CHECK_ERROR(eml_net_infer(model, features, features_length));
+    EML_CHECK_ERROR(eml_net_context_infer(model, ctx, features, features_length));
 
     for (int i = 0; i < n_outputs; i++)
     {
-        const float p = model->activations2[i];
+        const float p = ctx->activations2[i];
         out[i] = p;
     }
 
     return EmlOk;
 }
 
+/**
+* \brief Run inference and return the predicted float array (last layer).
+*
+* \param model EmlNet instance
+* \param features Input data values
+* \param features_length Length of input data
+* \param out Buffer to store output
+* \param out_length Length of output buffer
+*
+* \return EmlOk on success, or error on failure
+*/
+EmlError
+eml_net_regress(EmlNet *model, const float *features, int32_t features_length, float *out, int32_t out_length)
+{
+    EML_PRECONDITION(eml_net_valid(model), EmlUninitialized);
+
+    EmlNetContext ctx = eml_net_model_context(model);
+    return eml_net_context_regress(model, &ctx, features, features_length, out, out_length);
+}
+
 /**
  * \brief Run inference and return single regression value
  *
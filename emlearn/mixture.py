@@ -21,30 +21,82 @@ def get_covariance_type(s):
     return 'EmlCovariance' + s.title()
 
 
-def generate_code(model, name='fss_mode'):
+def pack_upper_triangular(matrix):
+    """Pack the upper triangle of a square matrix, column by column
+
+    Column f contributes the f+1 entries of rows 0..f,
+    matching the precisions_packed layout of EmlMixtureModel
+    """
+    n = matrix.shape[0]
+    assert matrix.shape == (n, n), matrix.shape
+    return numpy.concatenate([ matrix[:f+1, f] for f in range(n) ])
+
+
+def is_upper_triangular(matrices):
+    lower = numpy.tril(numpy.ones(matrices.shape[-2:], dtype=bool), k=-1)
+    return not numpy.any(matrices[..., lower])
+
+
+def generate_code(model, name='fss_mode', pack_precisions=True, project_means=True,
+        online=False, step_size=0.01, min_variance=1e-6):
+    """Generate C code for the model
+
+    With online=True, the model arrays are writable,
+    and a {name}_update() function updates the model with new samples using online EM.
+    """
 
     cgen.assert_valid_identifier(name)
 
     means = model._means
     log_det = model._log_det
-    covar_type = get_covariance_type(model._covariance_type)
+    covariance_type = model._covariance_type
+    covar_type = get_covariance_type(covariance_type)
     precisions = model._precisions_col
     log_weights = model._log_weights
 
     n_components, n_features = means.shape
 
+    # For full and tied, the projection of the means only depends on the model
+    mean_projections = None
+    if project_means and covariance_type == 'full':
+        mean_projections = numpy.einsum('cp,cpf->cf', means, precisions)
+    elif project_means and covariance_type == 'tied':
+        mean_projections = means @ precisions
+
+    # Cholesky factors of the precisions are upper triangular, only store the non-zero part
+    packed = False
+    if pack_precisions and covariance_type in ('full', 'tied') and is_upper_triangular(precisions):
+        if covariance_type == 'full':
+            precisions = numpy.stack([ pack_upper_triangular(p) for p in precisions ])
+        else:
+            precisions = pack_upper_triangular(precisions)
+        packed = True
+
+    if online and covariance_type == 'tied':
+        raise ValueError("Online updates are not supported for covariance_type='tied'")
+
+    # online updates write to the model arrays
+    modifiers = 'static' if online else 'static const'
+
+    mean_projections_name = 'NULL'
+    mean_projections_arr = ''
+    if mean_projections is not None:
+        mean_projections_name = f'{name}_mean_projections'
+        mean_projections_arr = cgen.array_declare(mean_projections_name,
+            values=mean_projections.flatten(), modifiers=modifiers)
+
     means_name = f'{name}_means'
     means_size = n_components * n_features
-    means_arr = cgen.array_declare(means_name, size=means_size, values=means.flatten())
+    means_arr = cgen.array_declare(means_name, size=means_size, values=means.flatten(), modifiers=modifiers)
 
     log_dets_name = f'{name}_log_dets'
-    log_dets_arr = cgen.array_declare(log_dets_name, values=log_det.flatten())
+    log_dets_arr = cgen.array_declare(log_dets_name, values=log_det.flatten(), modifiers=modifiers)
 
     precisions_name = f'{name}_precisions'
-    precisions_arr = cgen.array_declare(precisions_name, values=precisions.flatten())
+    precisions_arr = cgen.array_declare(precisions_name, values=precisions.flatten(), modifiers=modifiers)
 
     log_weights_name = f'{name}_log_weights'
-    log_weights_arr = cgen.array_declare(log_weights_name, values=log_weights.flatten())
+    log_weights_arr = cgen.array_declare(log_weights_name, values=log_weights.flatten(), modifiers=modifiers)
 
 
     predict_func = f'''
@@ -67,6 +119,16 @@ def generate_code(model, name='fss_mode'):
                                 probabilities, score);
         }}
 
+        int32_t
+        {name}_score_batch(const float values[], int32_t n_samples, int32_t values_length,
+                    float *probabilities, float *scores)
+        {{
+
+            return eml_mixture_score_batch(&{name}_model,
+                                values, n_samples, values_length,
+                                probabilities, scores);
+        }}
+
         int32_t
         {name}_predict_proba(const float values[], int32_t values_length, float *probabilities, float *score, float *resp)
         {{
@@ -85,6 +147,8 @@ def generate_code(model, name='fss_mode'):
         precisions_name,
         log_dets_name,
         log_weights_name,
+        mean_projections_name,
+        1 if packed else 0,
     ) + ';\n'
 
     preamble = """
@@ -93,15 +157,42 @@ def generate_code(model, name='fss_mode'):
     #include <eml_mixture.h>
     """
 
+    online_lines = []
+    if online:
+        scratch_length = (2 * n_components) + (3 * n_features)
+        online_lines = [
+            cgen.array_declare(f'{name}_scratch', size=scratch_length, modifiers='static'),
+            f'EmlMixtureOnline {name}_online = ' + cgen.struct_init(
+                means_name,
+                precisions_name,
+                log_dets_name,
+                log_weights_name,
+                mean_projections_name,
+                f'{name}_scratch',
+                scratch_length,
+                cgen.constant(step_size),
+                cgen.constant(min_variance),
+            ) + ';\n',
+            f'''
+            int32_t
+            {name}_update(const float values[], int32_t values_length)
+            {{
+                return eml_mixture_update(&{name}_model, &{name}_online,
+                                values, values_length);
+            }}
+            ''',
+        ]
+
     out = '\n'.join([
         preamble,
         means_arr,
         precisions_arr,
         log_weights_arr,
         log_dets_arr,
+        mean_projections_arr,
         model_init,
         predict_func,
-    ])
+    ] + online_lines)
 
     return out
 
@@ -132,7 +223,8 @@ def predict(bin_path, X, verbose=1):
 def build_executable(wrapper, out_dir, output_type, name='gmm'):
     n_components, n_features = wrapper._means.shape
 
-    model_code = generate_code(wrapper, name=name)
+    model_code = generate_code(wrapper, name=name,
+        pack_precisions=wrapper.pack_precisions, project_means=wrapper.project_means)
 
     includes = """
     #include <stdio.h> // printf
@@ -223,8 +315,9 @@ def convert_to_full(means, precisions_chol, covariance_type):
     """
     Convert the different covariance structures into "full" covariance matrix form.
 
-    This means only a single inference implementation is needed.
-    Likely less optimal in terms of run-time, but much simpler.
+    The C code supports all the covariance types natively,
+    and the specialized ones are much cheaper to evaluate.
+    Can be used to compare against the full covariance implementation.
     """
 
     n_components, n_features = means.shape
@@ -298,23 +391,23 @@ def get_log_weights(estimator):
 
 
 class Wrapper:
-    def __init__(self, estimator, classifier, dtype='float', verbose=0):
+    def __init__(self, estimator, classifier, dtype='float', verbose=0,
+            pack_precisions=True, project_means=True):
         self.dtype = dtype
         self.verbose = verbose
+        self.pack_precisions = pack_precisions
+        self.project_means = project_means
 
         n_components, n_features = estimator.means_.shape
         covariance_type = estimator.covariance_type
         precisions_chol = estimator.precisions_cholesky_
 
-        # Convert all types to "full" covariance matrix
-        # TODO: native aupport for tied/diag/spherical
-        precisions_chol = convert_to_full(estimator.means_, precisions_chol, covariance_type)
-        covariance_type = 'full'
-
         from sklearn.mixture._gaussian_mixture import _compute_log_det_cholesky
 
         log_det = _compute_log_det_cholesky(
             precisions_chol, covariance_type, n_features)
+        # tied has a single log determinant, the C code expects one per component
+        log_det = numpy.broadcast_to(log_det, (n_components,))
 
         self._log_det = log_det
         self._means = estimator.means_.copy()
@@ -366,7 +459,8 @@ class Wrapper:
             else:
                 name = os.path.splitext(os.path.basename(file))[0]
 
-        code = generate_code(self, name=name)
+        code = generate_code(self, name=name,
+            pack_precisions=self.pack_precisions, project_means=self.project_means)
         if file:
             with open(file, 'w') as f:
                 f.write(code)
@@ -9,10 +9,19 @@ from . import common, cgen
 import numpy
 
 import os.path
+import sys
+import tempfile
 import warnings
 
 SUPPORTED_METRICS = set(['euclidean'])
-SUPPORTED_WEIGHTS = set(['uniform'])
+SUPPORTED_WEIGHTS = set(['uniform', 'distance'])
+WEIGHTING_ENUM = {
+    'uniform': 'EmlNeighborsWeightUniform',
+    'distance': 'EmlNeighborsWeightDistance',
+}
+
+# EmlNeighborsModel uses int16_t for item counts and indices
+INT16_MAX = 32767
 
 def check_params_supported(estimator):
 
@@ -28,24 +37,96 @@ def check_params_supported(estimator):
         raise ValueError(f'Unsupported weights: {weights}. Supported: {SUPPORTED_WEIGHTS}')
 
     algorithm = estimator.algorithm
-    if algorithm not in ('brute', 'auto'):
-        warnings.warn('emlearn only implements "brute" for Nearest Neighbors. Ignoring setting algorithm={algorithm}')
+    if algorithm == 'ball_tree':
+        warnings.warn('emlearn implements "kd_tree" and "brute" for Nearest Neighbors. Using kd_tree instead of ball_tree')
+
+
+def select_algorithm(algorithm, n_items, n_features, leaf_size):
+    """Pick the search strategy for the C code. Returns 'kd_tree' or 'brute'"""
+    if algorithm in ('kd_tree', 'ball_tree'):
+        return 'kd_tree'
+    elif algorithm == 'brute':
+        return 'brute'
+    elif algorithm == 'auto':
+        # KD-trees only pay off with low-dimensional data and many items
+        if n_features <= 16 and n_items >= 4*leaf_size:
+            return 'kd_tree'
+        return 'brute'
+    else:
+        raise ValueError(f"Unsupported algorithm '{algorithm}'")
+
+
+def build_kdtree(data, leaf_size=30, max_depth=32):
+    """Build a static KD-tree over data
+
+    Splits on the feature with the largest spread, at the median.
+    Each leaf covers a contiguous range of items in the returned order,
+    so the data should be reordered with it.
+
+    :return: (order, nodes), where nodes are (feature, value, left, right) tuples.
+        For leaves feature is -1, and [left, right) is the range of items
+    """
+    data = numpy.asarray(data)
+    order = []
+    nodes = []
+
+    def leaf(node_idx, indices):
+        start = len(order)
+        order.extend(indices)
+        nodes[node_idx] = (-1, 0, start, len(order))
+        return node_idx
+
+    def build(indices, depth):
+        node_idx = len(nodes)
+        nodes.append(None)
+        if len(indices) <= leaf_size or depth >= max_depth:
+            return leaf(node_idx, indices)
+
+        values = data[indices]
+        spread = values.max(axis=0) - values.min(axis=0)
+        feature = int(numpy.argmax(spread))
+        if spread[feature] == 0:
+            return leaf(node_idx, indices)
+
+        # left has values <= split value, right has values >= split value
+        sorted_indices = indices[numpy.argsort(values[:, feature], kind='stable')]
+        mid = len(sorted_indices) // 2
+        value = int(data[sorted_indices[mid], feature])
+        left = build(sorted_indices[:mid], depth+1)
+        right = build(sorted_indices[mid:], depth+1)
+        nodes[node_idx] = (feature, value, left, right)
+        return node_idx
+
+    if len(data):
+        build(numpy.arange(len(data)), 0)
+
+    return numpy.array(order, dtype=int), nodes
 
 
 class Wrapper:
-    def __init__(self, estimator, inference='loadable', return_type='classifier'):
+    def __init__(self, estimator, inference='loadable', return_type='classifier',
+            reorder_features=False,
+            compression=None):
 
         check_params_supported(estimator)
 
         self.fit_data_X = estimator._fit_X
         self.fit_data_Y = estimator._y
         self.n_neighbors = estimator.n_neighbors
+        self.n_classes = len(estimator.classes_)
+        self.weights = estimator.weights
         self.inference = inference
+        self.leaf_size = estimator.leaf_size
+        self.reorder_features = reorder_features
+        self.compression = compression
+        self.algorithm = select_algorithm(estimator.algorithm,
+            n_items=self.fit_data_X.shape[0], n_features=self.fit_data_X.shape[1], leaf_size=self.leaf_size)
 
         name = 'mymodel'
 
         if inference == 'loadable':
-            distance_length = len(self.fit_data_X)
+            # only the k nearest are kept during predict
+            distance_length = self.n_neighbors
             n_features = self.fit_data_X.shape[1]
 
             model_init = self.save(name=name)
@@ -74,17 +155,28 @@ class Wrapper:
                     }}
                     return out;
                 }}
+
+                int
+                predict_proba_func(const float *values, int length, float *out, int out_length) {{
+                    int16_t features[{n_features}];
+                    for (int i=0; i<length; i++) {{
+                        features[i] = (int16_t)values[i];
+                    }}
+                    return -eml_neighbors_predict_proba(&{name}, features, length,
+                        distance_array, {distance_length}, out, out_length);
+                }}
                 """
             ])
             func = 'predict_func(values, length)'
+            proba_func = 'predict_proba_func(values, length, outputs, N_CLASSES)'
 
-
-            self.classifier = common.CompiledClassifier(code, name=name, call=func)
+            self.classifier = common.CompiledClassifier(code, name=name, call=func,
+                proba_call=proba_func, n_classes=self.n_classes)
         else:
             raise ValueError(f"Unsupported inference method '{inference}'")
 
     def predict_proba(self, X):
-        raise NotImplementedError('predict_proba() not yet supported')
+        return self.classifier.predict_proba(X)
 
     def predict(self, X):
         return self.classifier.predict(X)
@@ -96,7 +188,11 @@ class Wrapper:
             else:
                 name = os.path.splitext(os.path.basename(file))[0]
 
-        code = c_generate_neighbors(self.fit_data_X, n_neighbors=self.n_neighbors, labels=self.fit_data_Y, prefix=name)
+        code = c_generate_neighbors(self.fit_data_X, n_neighbors=self.n_neighbors, labels=self.fit_data_Y, prefix=name,
+            algorithm=self.algorithm, leaf_size=self.leaf_size,
+            n_classes=self.n_classes, weights=self.weights,
+            reorder_features=self.reorder_features,
+            compression=self.compression)
         if file:
             with open(file, 'w') as f:
                 f.write(code)
@@ -120,17 +216,196 @@ def c_generate_convenience_functions(module_name, name,
 
     return [ predict_function ]
 
-def neighbors_model_init(name, n_neighbors, n_features, n_items, max_items, data, labels):
+def neighbors_model_init(name, n_neighbors, n_features, n_items, max_items, data, labels,
+        feature_order='NULL', tree_nodes='NULL', tree_n_nodes=0, tree_items=0,
+        compressed='NULL', n_classes=0, weighting='EmlNeighborsWeightUniform'):
 
     # NOTE: order must match the EmlNeighbors C typedef
-    values = ( n_features, n_items, max_items, data, labels, n_neighbors )
+    replace_next = 0
+    n_seen = 0
+    values = ( n_features, n_items, max_items, data, labels, n_neighbors,
+        tree_nodes, tree_n_nodes, tree_items, compressed,
+        replace_next, n_seen, n_classes, weighting, feature_order )
     out = cgen.struct_declare(name, type_name='EmlNeighborsModel', values=values)
     return out
 
+def needs_distance_64(data, headroom=2.0):
+    """Whether squared distances on this data can overflow 32 bit accumulation
+
+    Queries are assumed to be within the range of the data, times headroom
+    """
+    if len(data) == 0:
+        return False
+    value_range = float(numpy.max(data)) - float(numpy.min(data))
+    max_diff = min(value_range * headroom, 2**16 - 1)
+    max_distance = data.shape[1] * (max_diff ** 2)
+    return max_distance >= 2**32
+
+def compress_int8(data):
+    """Compress int16 data into int8 codes, with per-feature offset and power-of-two scale
+
+    Mirrors eml_neighbors_compress_value() in C, so items added on device are compressed the same way.
+
+    :return: (codes, offsets, shifts, reconstructed)
+    """
+    data = numpy.asarray(data).astype(numpy.int64)
+    lo = data.min(axis=0)
+    hi = data.max(axis=0)
+    offsets = numpy.round((lo + hi) / 2.0).astype(numpy.int64)
+    half_range = numpy.maximum(hi - offsets, offsets - lo)
+    shifts = numpy.zeros(len(offsets), dtype=numpy.int64)
+    while True:
+        too_large = numpy.ceil(half_range / (2 ** shifts)) > 127
+        if not numpy.any(too_large):
+            break
+        shifts[too_large] += 1
+
+    # round to nearest, half away from zero
+    diff = data - offsets
+    half = numpy.where(shifts > 0, 2 ** numpy.maximum(shifts - 1, 0), 0)
+    codes = numpy.sign(diff) * ((numpy.abs(diff) + half) >> shifts)
+    codes = numpy.clip(codes, -128, 127)
+    # reconstruction must fit in int16
+    reconstructed = codes * (2 ** shifts) + offsets
+    codes = numpy.where(reconstructed > 32767, codes - 1, codes)
+    codes = numpy.where(reconstructed < -32768, codes + 1, codes)
+    reconstructed = codes * (2 ** shifts) + offsets
+
+    return codes.astype(numpy.int8), offsets.astype(numpy.int16), shifts.astype(numpy.uint8), reconstructed
+
+def knn_indices(data, queries, n_neighbors):
+    """Exact k nearest neighbors, with ties broken by index like the C code"""
+    data = numpy.asarray(data).astype(numpy.int64)
+    out = []
+    for q in numpy.asarray(queries).astype(numpy.int64):
+        distances = numpy.sum((data - q)**2, axis=1)
+        order = numpy.lexsort((numpy.arange(len(data)), distances))
+        out.append(order[:n_neighbors])
+    return numpy.array(out)
+
+def compression_report(data, queries, n_neighbors=5, compression='int8',
+        benchmark=True, repetitions=10, out_dir=None, compile_args=None):
+    """Compare a compressed reference set against the exact one
+
+    Recall is the fraction of the exact k nearest that are also found using the compressed items.
+    When benchmark=True, the C code for both is compiled and the scan time per query is measured.
+    Use compile_args to benchmark with the flags of the target, like -mavx2.
+    The benchmark is built in out_dir, or in a temporary directory if None.
+
+    :return: dict with recall, memory use and timings
+    """
+    if compression != 'int8':
+        raise ValueError(f"Unsupported compression '{compression}'")
+
+    data = numpy.asarray(data)
+    queries = numpy.asarray(queries)
+    n_items, n_features = data.shape
+
+    codes, offsets, shifts, reconstructed = compress_int8(data)
+    exact = knn_indices(data, queries, n_neighbors)
+    approx = knn_indices(reconstructed, queries, n_neighbors)
+    recall = numpy.mean([ len(set(e) & set(a)) / n_neighbors for e, a in zip(exact, approx) ])
+
+    report = dict(
+        recall=recall,
+        bytes_exact=data.size*2,
+        bytes_compressed=codes.size + n_features*3,
+    )
+    report['compression_ratio'] = report['bytes_exact'] / report['bytes_compressed']
+
+    if benchmark:
+        timings = benchmark_compression(data, queries, n_neighbors, out_dir=out_dir,
+            repetitions=repetitions, compile_args=compile_args)
+        report.update(timings)
+        report['speedup'] = report['time_exact_us'] / max(report['time_compressed_us'], 1e-9)
+
+    return report
+
+def benchmark_compression(data, queries, n_neighbors, out_dir=None, repetitions=10,
+        compile_args=None):
+    """Measure time per query for exact and int8-compressed kNN, in compiled C code"""
+    if out_dir is None:
+        with tempfile.TemporaryDirectory() as temp_dir:
+            return benchmark_compression(data, queries, n_neighbors, out_dir=temp_dir,
+                repetitions=repetitions, compile_args=compile_args)
+
+    labels = numpy.zeros(len(data), dtype=int)
+    # both models in the same file, so the header is only included once
+    distance_64 = needs_distance_64(data)
+    exact = c_generate_neighbors(data, labels, n_neighbors, prefix='exact',
+        distance_64=distance_64)
+    compressed = c_generate_neighbors(data, labels, n_neighbors, prefix='compressed',
+        distance_64=distance_64, compression='int8', include_header=False)
+
+    n_queries, n_features = queries.shape
+    query_values = cgen.array_declare('queries', values=numpy.asarray(queries).flatten(),
+        dtype='int16_t', modifiers='static const')
+
+    code = f"""
+    #include <stdio.h>
+    #include <eml_benchmark.h>
+    {exact}
+    {compressed}
+    {query_values}
+
+    static int64_t
+    run(EmlNeighborsModel *model) {{
+        EmlNeighborsDistanceItem nearest[{n_neighbors}];
+        int64_t best = -1;
+        for (int r=0; r<{repetitions}; r++) {{
+            const int64_t start = eml_benchmark_micros();
+            for (int q=0; q<{n_queries}; q++) {{
+                eml_neighbors_infer_nearest(model, queries+(q*{n_features}), {n_features},
+                    {n_neighbors}, nearest, {n_neighbors});
+            }}
+            const int64_t duration = eml_benchmark_micros() - start;
+            if (best < 0 || duration < best) {{
+                best = duration;
+            }}
+        }}
+        return best;
+    }}
+
+    int main() {{
+        const int64_t exact_us = run(&exact);
+        const int64_t compressed_us = run(&compressed);
+        printf("%lld,%lld\\n", (long long)exact_us, (long long)compressed_us);
+        return 0;
+    }}
+    """
+
+    if not os.path.exists(out_dir):
+        os.makedirs(out_dir)
+    src_path = os.path.join(out_dir, 'knn_compression.c')
+    with open(src_path, 'w') as f:
+        f.write(code)
+    if compile_args is None:
+        compile_args = [] if sys.platform.startswith('win') else [ '-O2' ]
+    bin_path = common.compile_executable(src_path, out_dir, name='knn_compression',
+        include_dirs=[ common.get_include_dir() ], extra_compile_args=compile_args)
+
+    import subprocess
+    out = subprocess.check_output([ bin_path ], encoding='utf8')
+    exact_us, compressed_us = [ float(v) for v in out.strip().split(',') ]
+    return dict(
+        time_exact_us=exact_us / n_queries,
+        time_compressed_us=compressed_us / n_queries,
+    )
+
 def c_generate_neighbors(data, labels, n_neighbors, prefix,
-            array_modifiers='static const'):
+            array_modifiers='static const',
+            distance_64=None,
+            algorithm='brute',
+            leaf_size=30,
+            n_classes=None,
+            weights='uniform',
+            reorder_features=False,
+            compression=None,
+            include_header=True):
 
     cgen.assert_valid_identifier(prefix)
+    if weights not in WEIGHTING_ENUM:
+        raise ValueError(f"Unsupported weights '{weights}'")
 
     model_name = prefix
 
@@ -138,31 +413,105 @@ def c_generate_neighbors(data, labels, n_neighbors, prefix,
     assert len(data.shape) == 2, data.shape
     data_name = prefix+'_data'
     n_items, n_features = data.shape
-    data_values = data.flatten()
+    if n_items > INT16_MAX:
+        raise ValueError(f"Too many items for EmlNeighborsModel: {n_items} > {INT16_MAX}")
 
     # Y/labels
     assert len(labels.shape) == 1, labels.shape
     labels_name = prefix+'_labels'
+    if n_classes is None:
+        n_classes = int(numpy.max(labels)) + 1 if len(labels) else 0
+
+    # Optional reordering of features by descending variance
+    # Makes early abandoning of distance computations more effective
+    order_lines = []
+    order_init = {}
+    if reorder_features:
+        feature_order = numpy.argsort(-numpy.var(data, axis=0), kind='stable')
+        data = data[:, feature_order]
+        order_name = prefix+'_feature_order'
+        order_lines.append(cgen.array_declare(order_name, values=feature_order,
+            dtype='int16_t', modifiers=array_modifiers))
+        order_init = dict(feature_order=f'(int16_t *){order_name}')
+
+    # Optional int8 compression of the items
+    # Search uses the reconstructed values, so the KD-tree is built on those
+    compressed_lines = []
+    compressed_init = {}
+    if compression == 'int8':
+        codes, offsets, shifts, reconstructed = compress_int8(data)
+        data = reconstructed
+    elif compression is not None:
+        raise ValueError(f"Unsupported compression '{compression}'")
+
+    # Optional KD-tree index. Items are stored in tree order
+    tree_lines = []
+    tree_init = {}
+    if algorithm == 'kd_tree':
+        order, nodes = build_kdtree(data, leaf_size=leaf_size)
+        if len(nodes) > INT16_MAX:
+            raise ValueError(f"Too many KD-tree nodes: {len(nodes)} > {INT16_MAX}. Increase leaf_size")
+        data = data[order]
+        labels = labels[order]
+        if compression is not None:
+            codes = codes[order]
+        tree_name = prefix+'_tree'
+        node_values = [ cgen.struct_init(*n) for n in nodes ]
+        tree_lines.append(cgen.array_declare(tree_name, values=node_values,
+            dtype='EmlNeighborsTreeNode', modifiers=array_modifiers))
+        tree_init = dict(tree_nodes=tree_name, tree_n_nodes=len(nodes), tree_items=n_items)
+    elif algorithm != 'brute':
+        raise ValueError(f"Unsupported algorithm '{algorithm}'")
+
+    data_values = data.flatten()
+
+    if compression == 'int8':
+        codes_name = prefix+'_codes'
+        offsets_name = prefix+'_offsets'
+        shifts_name = prefix+'_shifts'
+        compressed_name = prefix+'_compressed'
+        compressed_lines += [
+            cgen.array_declare(codes_name, values=codes.flatten(), dtype='int8_t', modifiers=array_modifiers),
+            cgen.array_declare(offsets_name, values=offsets, dtype='int16_t', modifiers=array_modifiers),
+            cgen.array_declare(shifts_name, values=shifts, dtype='uint8_t', modifiers=array_modifiers),
+            cgen.struct_declare(compressed_name, 'EmlNeighborsCompressed',
+                values=[ f'(int8_t *){codes_name}', offsets_name, shifts_name ]),
+        ]
+        compressed_init = dict(compressed='&'+compressed_name)
 
     max_items = n_items
 
-    head_lines = [
-        '#include <eml_neighbors.h>'    
-    ]
+    if distance_64 is None:
+        distance_64 = needs_distance_64(data)
+
+    head_lines = []
+    if include_header:
+        if distance_64:
+            head_lines += [
+                '#define EML_NEIGHBORS_DISTANCE_64 1',
+            ]
+        head_lines += [
+            '#include <eml_neighbors.h>'
+        ]
 
     def declare_array(name, values):
         return cgen.array_declare(name, values=values, dtype='int16_t', modifiers=array_modifiers)
 
-    model_lines = [
-        declare_array(data_name, values=data_values),
+    data_lines = [] if compression else [ declare_array(data_name, values=data_values) ]
+    model_lines = order_lines + tree_lines + compressed_lines + data_lines + [
         declare_array(labels_name, values=labels),
         neighbors_model_init(name=model_name,
             labels=f'(int16_t *){labels_name}',
-            data=f'(int16_t *){data_name}',
+            data='NULL' if compression else f'(int16_t *){data_name}',
             n_neighbors=n_neighbors,
             n_features=n_features,
             n_items=n_items,
             max_items=max_items,
+            n_classes=n_classes,
+            weighting=WEIGHTING_ENUM[weights],
+            **order_init,
+            **tree_init,
+            **compressed_init,
         ),
     ]
 
@@ -173,9 +522,9 @@ def c_generate_neighbors(data, labels, n_neighbors, prefix,
 
     return out
 
-def convert_sklearn(model, inference):
-    """Convert sklearn.neural_network.MLPClassifier models"""
+def convert_sklearn(model, inference, **kwargs):
+    """Convert sklearn.neighbors.KNeighborsClassifier models"""
 
-    return Wrapper(model, inference=inference)
+    return Wrapper(model, inference=inference, **kwargs)
 
 
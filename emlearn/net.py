@@ -20,6 +20,13 @@ ACTIVATION_FUNCTIONS = [
     "tanh",
 ]
 
+# corresponds to EmlNetWeightType in C
+WEIGHT_TYPES = {
+    "float": "EmlNetWeightFloat32",
+    "float16": "EmlNetWeightFloat16",
+    "bfloat16": "EmlNetWeightBFloat16",
+}
+
 def argmax(sequence):
     max_idx = 0
     max_value = sequence[0]
@@ -34,6 +41,8 @@ class Wrapper:
     def __init__(self, activations, weights, biases, classifier,
             return_type='classifier',
             use_fixedpoint=False,
+            weights_dtype='float',
+            register_block=4,
         ):
 
         self.activations = activations
@@ -43,6 +52,8 @@ class Wrapper:
         self.return_type = return_type
         self.inference_type = classifier
         self.use_fixedpoint = use_fixedpoint
+        self.weights_dtype = layer_weight_types(weights_dtype, n_layers=len(weights))
+        self.register_block = register_block
 
         n_outputs = self.weights[-1].shape[1]
         if n_outputs == 1:
@@ -50,6 +61,8 @@ class Wrapper:
 
         if self.use_fixedpoint and self.inference_type != 'inline':
             raise NotImplementedError("Fixed-point only implemented with 'inline' inference type")
+        if self.use_fixedpoint and any(t != 'float' for t in self.weights_dtype):
+            raise NotImplementedError("Fixed-point cannot be combined with weights_dtype")
 
         name = 'mynet'
         if self.inference_type == 'loadable' and return_type == 'classifier':
@@ -62,7 +75,7 @@ class Wrapper:
             code = self.save(name=name)
             self.classifier = common.CompiledClassifier(code, name=name, call=func, out_dtype='float')
         elif self.inference_type == 'inline' and return_type == 'classifier':
-            code = self.save(name=name)
+            code = self.save(name=name, inference=['inline'])
 
             if self.use_fixedpoint:
                 # inject a conversion between float and fixed-point
@@ -110,11 +123,15 @@ class Wrapper:
 
         code = ""
         if 'loadable' in inference:
-            code += '\n' + c_generate_net_loadable(self.activations, self.weights, self.biases, prefix=name)
+            code += '\n' + c_generate_net_loadable(self.activations, self.weights, self.biases, prefix=name,
+                weights_dtype=self.weights_dtype,
+            )
         if 'inline' in inference:
             code += '\n' + c_generate_net_inline(self.activations, self.weights, self.biases,
                 prefix=name,
                 use_fixedpoint=self.use_fixedpoint,
+                weights_dtype=self.weights_dtype,
+                register_block=self.register_block,
             )
         if not code:
             raise ValueError("No code generated. Check that 'inference' specifies valid strategies")
@@ -125,10 +142,50 @@ class Wrapper:
 
         return code
 
-def array_declare(name, fixedpoint : FixedPointFormat = None, **kwargs):
+def layer_weight_types(weights_dtype, n_layers : int):
+    """
+    Normalize weights_dtype into one weight type per layer
+
+    Can be specified as a single type used for all layers, or a list with one type per layer.
+    """
+    if weights_dtype is None:
+        weights_dtype = 'float'
+    if isinstance(weights_dtype, str):
+        weights_dtype = [ weights_dtype ] * n_layers
+
+    weights_dtype = list(weights_dtype)
+    if len(weights_dtype) != n_layers:
+        raise ValueError(f"weights_dtype must have one entry per layer. Got {len(weights_dtype)}, expected {n_layers}")
+    for t in weights_dtype:
+        if t not in WEIGHT_TYPES:
+            raise ValueError(f"Unsupported weights_dtype '{t}'. Supported: {set(WEIGHT_TYPES.keys())}")
+
+    return weights_dtype
+
+def to_float16_bits(values):
+    """Convert to IEEE 754 half-precision, returned as the raw 16 bit patterns"""
+    return numpy.asarray(values, dtype=numpy.float16).view(numpy.uint16)
+
+def to_bfloat16_bits(values):
+    """Convert to bfloat16 (upper 16 bits of float32), with round-to-nearest-even"""
+    bits = numpy.asarray(values, dtype=numpy.float32).view(numpy.uint32).astype(numpy.uint64)
+    rounding = 0x7FFF + ((bits >> 16) & 1)
+    out = ((bits + rounding) >> 16).astype(numpy.uint16)
+    return out
+
+def array_declare(name, fixedpoint : FixedPointFormat = None, dtype : str = 'float', values=None, **kwargs):
+
+    if dtype in ('float16', 'bfloat16'):
+        # Stored as raw 16 bit patterns, widened to float at inference time
+        assert fixedpoint is None
+        convert = to_float16_bits if dtype == 'float16' else to_bfloat16_bits
+        return cgen.array_declare(name, dtype='uint16_t', values=convert(values), **kwargs)
 
     # if fixedpoint==None, uses float
-    return cgen.array_declare_fixedpoint(name, fixedpoint=fixedpoint, **kwargs)
+    return cgen.array_declare_fixedpoint(name, fixedpoint=fixedpoint, values=values, **kwargs)
+
+def c_weight_type(dtype : str):
+    return WEIGHT_TYPES[dtype]
 
 
 def c_activation_function(activation : str):
@@ -143,6 +200,7 @@ def c_activation_function(activation : str):
 def c_generate_layer_data(activations, weights, biases, prefix : str,
             include_constants=True,
             use_fixedpoint=False,
+            weights_dtype=None,
             arr_modifiers = 'static const'):
 
     declarations = []
@@ -154,10 +212,12 @@ def c_generate_layer_data(activations, weights, biases, prefix : str,
 
     # TODO: pick most appropriate fixed-point format
     weights_format = FixedPointFormat(integer_bits=8, fraction_bits=23) if use_fixedpoint else None
+    weights_dtype = layer_weight_types(weights_dtype, n_layers=len(weights))
 
     # Layers
     for layer_no, (l_act, l_weights, l_bias) in enumerate(zip(activations, weights, biases)):
         n_in, n_out = l_weights.shape
+        l_dtype = weights_dtype[layer_no]
 
         # layer sizes
         if include_constants:
@@ -170,7 +230,7 @@ def c_generate_layer_data(activations, weights, biases, prefix : str,
         if include_constants:
             activation_name = format_name(layer_no, 'activation')
             activation_func = c_activation_function(l_act)
-            add_declaration(cgen.constant_declare(activation_name, activation_func))
+            add_declaration(cgen.constant_declare(activation_name, activation_func, dtype='EmlNetActivationFunction'))
 
         # bias
         biases_name = format_name(layer_no, 'biases') 
@@ -182,16 +242,66 @@ def c_generate_layer_data(activations, weights, biases, prefix : str,
         weights_name = format_name(layer_no, 'weights') 
         weight_values = numpy.array(l_weights).flatten(order='C')
         weights_arr = array_declare(weights_name, size=n_in * n_out,
-            values=weight_values, modifiers=arr_modifiers, fixedpoint=weights_format)
+            values=weight_values, modifiers=arr_modifiers, fixedpoint=weights_format, dtype=l_dtype)
         add_declaration(weights_arr)
 
     return declarations
 
+# C expression for applying activation function to a value, fused with the layer computation
+# Softmax needs all outputs, and is applied afterwards
+FUSED_ACTIVATIONS = {
+    "identity": "{}",
+    "relu": "eml_net_relu({})",
+    "logistic": "eml_net_expit({})",
+    "softmax": "{}",
+    "tanh": "eml_net_tanh({})",
+}
+
+def c_layer_specs(activations, weights, weights_dtype, register_block : int):
+    """
+    Describe each layer for the inline (unrolled) float code generation
+
+    Outputs are split into blocks of register_block, each computed with its own accumulators.
+    Buffers alternate between layers, such that the last layer writes to activations2.
+    """
+    n_layers = len(weights)
+    specs = []
+    for layer_no, (l_act, l_weights, l_dtype) in enumerate(zip(activations, weights, weights_dtype)):
+        n_in, n_out = l_weights.shape
+        c_activation_function(l_act) # check supported
+
+        outputs = list(range(n_out))
+        blocks = [ outputs[i:i+register_block] for i in range(0, n_out, register_block) ]
+
+        to_last = n_layers - 1 - layer_no
+        output = 'activations2' if (to_last % 2) == 0 else 'activations1'
+        input = 'in' if layer_no == 0 else specs[-1]['output']
+
+        specs.append(dict(
+            no=layer_no,
+            n_in=n_in,
+            n_out=n_out,
+            activation=l_act,
+            activation_expr=FUSED_ACTIVATIONS[l_act],
+            compact=None if l_dtype == 'float' else c_weight_type(l_dtype),
+            blocks=blocks,
+            input=input,
+            output=output,
+        ))
+
+    return specs
+
 def c_generate_net_inline(activations, weights, biases, prefix : str,
         use_fixedpoint = False,
+        weights_dtype = None,
+        register_block : int = 4,
         data_modifiers : str = 'static const'):
     """
     Generate C code for a particular neural network. Aka the "inline" inference strategy
+
+    For floating point, each layer gets its own function with constant dimensions.
+    The outputs are computed in blocks of register_block accumulators,
+    with the bias and activation fused into the same pass.
     """
 
     cgen.assert_valid_identifier(prefix)
@@ -206,7 +316,7 @@ def c_generate_net_inline(activations, weights, biases, prefix : str,
     from jinja2 import Environment, FileSystemLoader
     here = os.path.dirname(__file__)
     template_dir = os.path.join(here, "templates/")
-    environment = Environment(loader=FileSystemLoader(template_dir))
+    environment = Environment(loader=FileSystemLoader(template_dir), trim_blocks=True, lstrip_blocks=True)
     template = environment.get_template(template_name)
 
     # Generate declarations
@@ -229,21 +339,28 @@ def c_generate_net_inline(activations, weights, biases, prefix : str,
     add_declaration(cgen.constant_declare(f'{prefix}_n_outputs', n_outputs))
 
     # Layers
-    declarations += c_generate_layer_data(activations, weights, biases, prefix, use_fixedpoint=use_fixedpoint)
+    weights_dtype = layer_weight_types(weights_dtype, n_layers=len(weights))
+    declarations += c_generate_layer_data(activations, weights, biases, prefix,
+        use_fixedpoint=use_fixedpoint, weights_dtype=weights_dtype)
 
     # Generate the neural network code
-    layer_numbers = list(range(len(activations)))
+    if use_fixedpoint:
+        layers = list(range(len(activations)))
+    else:
+        if register_block < 1:
+            raise ValueError(f"register_block must be 1 or higher, got {register_block}")
+        layers = c_layer_specs(activations, weights, weights_dtype, register_block=register_block)
 
     out = template.render(
         prefix=prefix,
         declarations=declarations,
-        layers=layer_numbers,
+        layers=layers,
     )
 
     return out
 
 
-def c_generate_net_loadable(activations, weights, biases, prefix):
+def c_generate_net_loadable(activations, weights, biases, prefix, weights_dtype=None):
     """
     Generate general C code for neural networks inference. Aka the "loadable" inference strategy
     """
@@ -252,8 +369,13 @@ def c_generate_net_loadable(activations, weights, biases, prefix):
         init = cgen.struct_init(n_layers, layers_name, buf1_name, buf2_name, buf_length)
         o = 'static EmlNet {name} = {init};'.format(**locals())
         return o
-    def init_layer(name, n_outputs, n_inputs, weights_name, biases_name, activation_func):
-        init = cgen.struct_init(n_outputs, n_inputs, weights_name, biases_name, activation_func)
+    def init_layer(name, n_outputs, n_inputs, weights_name, biases_name, activation_func, weights_type):
+        # NOTE: order must match the EmlNetLayer C struct
+        if weights_type == 'float':
+            init = cgen.struct_init(n_outputs, n_inputs, weights_name, biases_name, activation_func)
+        else:
+            init = cgen.struct_init(n_outputs, n_inputs, 'NULL', biases_name, activation_func,
+                c_weight_type(weights_type), weights_name)
         return init
 
     cgen.assert_valid_identifier(prefix)
@@ -273,8 +395,9 @@ def c_generate_net_loadable(activations, weights, biases, prefix):
     layer_lines = []
     layers = []
 
+    weights_dtype = layer_weight_types(weights_dtype, n_layers=len(weights))
     layer_declarations = c_generate_layer_data(activations, weights, biases, prefix,
-            include_constants=False)
+            include_constants=False, weights_dtype=weights_dtype)
     for d in layer_declarations:
         layer_lines.append(d['code'])
 
@@ -283,7 +406,8 @@ def c_generate_net_loadable(activations, weights, biases, prefix):
         layer = f'{prefix}_layer_{layer_no}'
 
         activation_func = c_activation_function(l_act)
-        l = init_layer(layer, n_out, n_in, f'{layer}_weights', f'{layer}_biases', activation_func)
+        l = init_layer(layer, n_out, n_in, f'{layer}_weights', f'{layer}_biases', activation_func,
+            weights_dtype[layer_no])
         layers.append('\n'+l)
 
     net_lines = [
@@ -324,6 +448,66 @@ def c_generate_net_loadable(activations, weights, biases, prefix):
 
     return out
 
+def fold_affine_input(scale, offset, weights, bias):
+    """Fold an elementwise affine transform x*scale+offset on the inputs of a dense layer
+
+    Returns the new (weights, bias) such that the layer computes the same outputs from x directly.
+    """
+    n_in = weights.shape[0]
+    scale = numpy.broadcast_to(numpy.asarray(scale, dtype=weights.dtype), (n_in,))
+    offset = numpy.broadcast_to(numpy.asarray(offset, dtype=weights.dtype), (n_in,))
+    return weights * scale[:, numpy.newaxis], bias + numpy.dot(offset, weights)
+
+def fold_affine_output(weights, bias, scale, offset):
+    """Fold an elementwise affine transform y*scale+offset on the (pre-activation) outputs of a dense layer"""
+    n_out = weights.shape[1]
+    scale = numpy.broadcast_to(numpy.asarray(scale, dtype=weights.dtype), (n_out,))
+    offset = numpy.broadcast_to(numpy.asarray(offset, dtype=weights.dtype), (n_out,))
+    return weights * scale[numpy.newaxis, :], bias * scale + offset
+
+def compose_affine(first, second):
+    """Combine two elementwise affine transforms (scale, offset), applied first then second"""
+    if first is None:
+        return second
+    s1, o1 = first
+    s2, o2 = second
+    return s1 * s2, o1 * s2 + o2
+
+def from_sklearn_scaler(scaler):
+    """Elementwise (scale, offset) for a fitted sklearn scaler"""
+    kind = type(scaler).__name__
+    if kind == 'StandardScaler':
+        # mean_ is also fitted when with_mean=False, so check the flags
+        scale = 1.0 / scaler.scale_ if scaler.with_std else 1.0
+        offset = -scaler.mean_ * scale if scaler.with_mean else 0.0
+    elif kind == 'MinMaxScaler':
+        if scaler.clip:
+            raise NotImplementedError("MinMaxScaler with clip=True cannot be folded")
+        scale, offset = scaler.scale_, scaler.min_
+    elif kind == 'MaxAbsScaler':
+        scale, offset = 1.0 / scaler.scale_, 0.0
+    else:
+        raise NotImplementedError(f"Preprocessing step '{kind}' is not supported")
+    return numpy.asarray(scale, dtype=float), numpy.asarray(offset, dtype=float)
+
+def from_keras_batchnorm(layer):
+    """Elementwise (scale, offset) for a keras BatchNormalization layer, in inference mode"""
+    axis = layer.axis[0] if isinstance(layer.axis, (list, tuple)) else layer.axis
+    assert axis in (-1, 1), 'BatchNormalization.axis must be -1'
+    def values(var):
+        return numpy.asarray(var.numpy() if hasattr(var, 'numpy') else var)
+    mean = values(layer.moving_mean)
+    variance = values(layer.moving_variance)
+    gamma = values(layer.gamma) if layer.scale else numpy.ones_like(mean)
+    beta = values(layer.beta) if layer.center else numpy.zeros_like(mean)
+    scale = gamma / numpy.sqrt(variance + layer.epsilon)
+    offset = beta - mean * scale
+    return scale, offset
+
+def from_keras_rescaling(layer):
+    """Elementwise (scale, offset) for a keras Rescaling layer"""
+    return numpy.asarray(layer.scale, dtype=float), numpy.asarray(layer.offset, dtype=float)
+
 def convert_sklearn_mlp(model, method, **kwargs):
     """Convert sklearn.neural_network.MLPClassifier models"""
 
@@ -336,6 +520,32 @@ def convert_sklearn_mlp(model, method, **kwargs):
 
     return Wrapper(activations, weights, biases, classifier=method, **kwargs)
 
+def convert_sklearn_pipeline(pipeline, method, **kwargs):
+    """Convert sklearn.pipeline.Pipeline with scalers followed by MLPClassifier/MLPRegressor
+
+    The scalers are folded into the weights and biases of the first layer,
+    so no separate normalization is done at inference time.
+    """
+
+    steps = [ step for _, step in pipeline.steps if step not in (None, 'passthrough') ]
+    model = steps[-1]
+    if type(model).__name__ not in ('MLPClassifier', 'MLPRegressor'):
+        raise ValueError("Last step of Pipeline must be MLPClassifier or MLPRegressor")
+    if (model.n_layers_ < 3):
+        raise ValueError("Model must have at least one hidden layer")
+
+    affine = None
+    for step in steps[:-1]:
+        affine = compose_affine(affine, from_sklearn_scaler(step))
+
+    weights = list(model.coefs_)
+    biases = list(model.intercepts_)
+    if affine is not None:
+        weights[0], biases[0] = fold_affine_input(*affine, weights[0], biases[0])
+    activations = [model.activation]*(len(weights)-1) + [ model.out_activation_ ]
+
+    return Wrapper(activations, weights, biases, classifier=method, **kwargs)
+
 def from_keras_activation(act):
     name = act.__name__
     remap = {
@@ -368,6 +578,18 @@ def convert_keras(model, method, **kwargs):
         # TODO: maybe make activation a separate layer in our representation
         activations[-1] = activation
 
+    # Elementwise affine transform (scale, offset) not yet folded into a Dense layer
+    pending = None
+
+    def add_affine(affine):
+        nonlocal pending
+        if activations and activations[-1] == 'identity' and pending is None:
+            # directly after a linear Dense layer, fold into its outputs
+            layer_weights[-1], biases[-1] = fold_affine_output(layer_weights[-1], biases[-1], *affine)
+        else:
+            # after a non-linearity or at the input, fold into the inputs of the next Dense layer
+            pending = compose_affine(pending, affine)
+
     for i, l in enumerate(model.layers):
         layer_type = type(l).__name__
 
@@ -375,6 +597,15 @@ def convert_keras(model, method, **kwargs):
         if layer_type == 'Dense':
             assert l.use_bias == True, 'Layers without bias not supported'
             add_dense(l.activation, *l.get_weights())
+            if pending is not None:
+                layer_weights[-1], biases[-1] = fold_affine_input(*pending, layer_weights[-1], biases[-1])
+                pending = None
+
+        # Normalization and scaling, folded into the weights
+        elif layer_type == 'BatchNormalization':
+            add_affine(from_keras_batchnorm(l))
+        elif layer_type == 'Rescaling':
+            add_affine(from_keras_rescaling(l))
     
         # Activations
         elif layer_type == 'Activation':
@@ -398,6 +629,8 @@ def convert_keras(model, method, **kwargs):
         else:
             raise NotImplementedError("Layer type '{}' is not implemented".format(layer_type)) 
 
+    if pending is not None:
+        raise NotImplementedError("Normalization after the last non-linear activation is not supported")
     assert len(activations) == len(biases) == len(layer_weights)
     
     return Wrapper(activations, layer_weights, biases, classifier=method, **kwargs)
@@ -58,11 +58,99 @@ bench_melspec()
     return EmlOk;
 }
 
+EmlError
+bench_fft()
+{
+    float times[EML_N_REPS];
+    float real[EML_N_FFT];
+    float imag[EML_N_FFT];
+    float interleaved[2*EML_N_FFT];
+
+    float fft_sin[EML_N_FFT_TABLE];
+    float fft_cos[EML_N_FFT_TABLE];
+    EmlFFT fft = { EML_N_FFT_TABLE, fft_sin, fft_cos };
+    EML_CHECK_ERROR(eml_fft_fill(fft, EML_N_FFT));
+
+    float twiddles[EML_FFT_TWIDDLES_LENGTH(EML_N_FFT)];
+    uint16_t swaps[EML_FFT_SWAPS_LENGTH(EML_N_FFT)];
+    EmlFFTPlan plan;
+    EML_CHECK_ERROR(eml_fft_init(&plan, EmlFFTComplex, EML_N_FFT,
+        twiddles, EML_FFT_TWIDDLES_LENGTH(EML_N_FFT), swaps, EML_FFT_SWAPS_LENGTH(EML_N_FFT)));
+
+    const char *names[3] = { "fft", "fft_plan", "fft_plan_interleaved" };
+    for (int variant=0; variant<3; variant++) {
+        float sum = 0.0f;
+        for (int i=0; i<EML_N_REPS; i++) {
+            eml_benchmark_fill(real, EML_N_FFT);
+            eml_benchmark_fill(imag, EML_N_FFT);
+            eml_benchmark_fill(interleaved, 2*EML_N_FFT);
+
+            const int64_t start = eml_benchmark_micros();
+            if (variant == 0) {
+                EML_CHECK_ERROR(eml_fft_forward(fft, real, imag, EML_N_FFT));
+            } else if (variant == 1) {
+                EML_CHECK_ERROR(eml_fft_plan_forward(&plan, real, imag, EML_N_FFT));
+            } else {
+                EML_CHECK_ERROR(eml_fft_plan_forward_interleaved(&plan, interleaved, EML_N_FFT));
+            }
+            times[i] = (float)(eml_benchmark_micros() - start);
+            sum += real[1] + interleaved[1];
+        }
+        const float mean = eml_signal_mean(times, EML_N_REPS);
+        printf("%s;%d;%f\n", names[variant], EML_N_REPS, mean);
+    }
+    return EmlOk;
+}
+
+#define EML_BENCH_CHANNELS 8
+
+EmlError
+bench_fft_channels()
+{
+    float times[EML_N_REPS];
+    static float real[EML_N_FFT*EML_BENCH_CHANNELS];
+    static float imag[EML_N_FFT*EML_BENCH_CHANNELS];
+
+    static float twiddles[EML_FFT_TWIDDLES_LENGTH(EML_N_FFT)];
+    static uint16_t swaps[EML_FFT_SWAPS_LENGTH(EML_N_FFT)];
+    EmlFFTPlan plan;
+    EML_CHECK_ERROR(eml_fft_init(&plan, EmlFFTComplex, EML_N_FFT,
+        twiddles, EML_FFT_TWIDDLES_LENGTH(EML_N_FFT), swaps, EML_FFT_SWAPS_LENGTH(EML_N_FFT)));
+
+    // one channel at a time (channel-major), versus all together (sample-major)
+    const char *names[2] = { "fft_plan_8ch_single", "fft_plan_8ch_batched" };
+    for (int variant=0; variant<2; variant++) {
+        float sum = 0.0f;
+        for (int i=0; i<EML_N_REPS; i++) {
+            eml_benchmark_fill(real, EML_N_FFT*EML_BENCH_CHANNELS);
+            eml_benchmark_fill(imag, EML_N_FFT*EML_BENCH_CHANNELS);
+
+            const int64_t start = eml_benchmark_micros();
+            if (variant == 0) {
+                for (int c=0; c<EML_BENCH_CHANNELS; c++) {
+                    EML_CHECK_ERROR(eml_fft_plan_forward(&plan,
+                        real + (c*EML_N_FFT), imag + (c*EML_N_FFT), EML_N_FFT));
+                }
+            } else {
+                EML_CHECK_ERROR(eml_fft_plan_forward_channels(&plan, real, imag,
+                    EML_N_FFT, EML_BENCH_CHANNELS, EML_BENCH_CHANNELS));
+            }
+            times[i] = (float)(eml_benchmark_micros() - start);
+            sum += real[1];
+        }
+        const float mean = eml_signal_mean(times, EML_N_REPS);
+        printf("%s;%d;%f\n", names[variant], EML_N_REPS, mean);
+    }
+    return EmlOk;
+}
+
 EmlError
 bench_all()
 {
     printf("task;repetitions;avg_time_us\n");
     EML_CHECK_ERROR(bench_melspec());
+    EML_CHECK_ERROR(bench_fft());
+    EML_CHECK_ERROR(bench_fft_channels());
     return EmlOk;
 }
 
@@ -11,6 +11,7 @@
 #include "test_quantizer.c"
 #include "test_trees.c"
 #include "test_net.c"
+#include "test_fft.c"
 
 #include <unity.c>
 
@@ -22,13 +23,14 @@ typedef struct _TestModule {
     TestModuleFunction func;
 } TestModule;
 
-#define TEST_MODULES 5
+#define TEST_MODULES 6
 TestModule test_modules[TEST_MODULES] = {
     { "array", test_eml_array },
     { "neighbors", test_eml_neighbors },
     { "quantizer", test_eml_quantizer },
     { "net", test_eml_net },
     { "trees", test_eml_trees },
+    { "fft", test_eml_fft },
 };
 
 void
@@ -28,20 +28,223 @@ DATASETS = {
     '5way': datasets.make_classification(n_classes=5, n_informative=5, n_samples=100, random_state=random),
 }
 METHODS = ['loadable']
+DTYPES = ['float', 'q16']
 
 @pytest.mark.parametrize("data", DATASETS.keys())
 @pytest.mark.parametrize("model", MODELS.keys())
 @pytest.mark.parametrize("method", METHODS)
-def test_bayes_equals_sklearn(data, model, method):
+@pytest.mark.parametrize("dtype", DTYPES)
+def test_bayes_equals_sklearn(data, model, method, dtype):
     X, y = DATASETS[data]
     estimator = MODELS[model]
 
     X = preprocessing.StandardScaler().fit_transform(X)
     estimator.fit(X, y)
 
-    cmodel = emlearn.convert(estimator, method=method)
+    cmodel = emlearn.convert(estimator, method=method, dtype=dtype)
     
     pred_original = estimator.predict(X[:5])
     pred_c = cmodel.predict(X[:5])
     numpy.testing.assert_equal(pred_c, pred_original)
 
+    proba_c = cmodel.predict_proba(X[:5])
+    numpy.testing.assert_allclose(proba_c.sum(axis=1), 1.0, atol=1e-5)
+    numpy.testing.assert_equal(numpy.argmax(proba_c, axis=1), pred_original)
+    if dtype == 'float':
+        numpy.testing.assert_allclose(proba_c, estimator.predict_proba(X[:5]), atol=1e-5)
+
+
+def test_bayes_float_all_samples():
+    # float model follows scikit-learn exactly, including class priors
+    X, y = datasets.make_classification(n_classes=8, n_informative=8, n_samples=600,
+        weights=[0.3]+[0.1]*7, random_state=1)
+    X = preprocessing.StandardScaler().fit_transform(X)
+    estimator = GaussianNB().fit(X, y)
+
+    cmodel = emlearn.convert(estimator, method='loadable', dtype='float')
+    assert 'EmlBayesFloatModel' in cmodel.save(name='nb')
+
+    numpy.testing.assert_equal(cmodel.predict(X), estimator.predict(X))
+
+def test_bayes_q16_constant_feature_within_class():
+    # Small-range data, and a feature that is constant within each class.
+    # Then epsilon_ is the only variance, and std is far below the Q16 resolution
+    rng = numpy.random.RandomState(1)
+    y = rng.randint(0, 2, size=200)
+    X = numpy.column_stack([ rng.uniform(0.0, 0.5, size=(len(y), 3)) + 0.1*y[:, numpy.newaxis], y ])
+    estimator = GaussianNB().fit(X, y)
+
+    cmodel = emlearn.convert(estimator, method='loadable', dtype='q16')
+    numpy.testing.assert_equal(cmodel.predict(X), estimator.predict(X))
+
+
+def test_bayes_batch_many_classes(tmp_path):
+    from emlearn import bayes, common, cgen
+
+    # more classes than EML_MAX_CLASSES, rows not a multiple of the batch size
+    n_classes, n_rows = 20, 45
+    X, y = datasets.make_classification(n_classes=n_classes, n_informative=10, n_features=10, n_redundant=0,
+        n_clusters_per_class=1, n_samples=1000, random_state=1)
+    X = preprocessing.StandardScaler().fit_transform(X)
+    estimator = GaussianNB().fit(X, y)
+    n_features = X.shape[1]
+
+    wrapper = emlearn.convert(estimator, method='loadable', dtype='float')
+    code = wrapper.save(name='nb') + f"""
+    #include <stdio.h>
+    {cgen.array_declare('samples', values=X[:n_rows].flatten())}
+    static float out[{n_rows*n_classes}];
+    int main() {{
+        if (eml_bayes_float_log_likelihood_batch(&nb_model, samples, {n_rows}, {n_features},
+                out, {n_rows*n_classes}) != EmlOk) {{
+            return 1;
+        }}
+        for (int i=0; i<{n_rows*n_classes}; i++) {{
+            printf("%.9g\\n", out[i]);
+        }}
+        if (eml_bayes_float_predict_proba_batch(&nb_model, samples, {n_rows}, {n_features},
+                out, {n_rows*n_classes}) != EmlOk) {{
+            return 2;
+        }}
+        for (int i=0; i<{n_rows*n_classes}; i++) {{
+            printf("%.9g\\n", out[i]);
+        }}
+        return 0;
+    }}
+    """
+    src_path = os.path.join(tmp_path, 'batch.c')
+    with open(src_path, 'w') as f:
+        f.write(code)
+    bin_path = common.compile_executable(src_path, str(tmp_path), name='batch',
+        include_dirs=[ common.get_include_dir() ])
+    out = subprocess.check_output([ bin_path ]).decode('utf-8')
+    values = numpy.array([ float(line) for line in out.split() ])
+    log_likelihood = values[:n_rows*n_classes].reshape(n_rows, n_classes)
+    proba = values[n_rows*n_classes:].reshape(n_rows, n_classes)
+
+    expect = estimator.predict_joint_log_proba(X[:n_rows])
+    numpy.testing.assert_allclose(log_likelihood, expect, rtol=1e-4)
+    numpy.testing.assert_allclose(proba, estimator.predict_proba(X[:n_rows]), atol=1e-5)
+
+def test_bayes_q16_batch_blocks(tmp_path):
+    from emlearn import common, cgen
+
+    # rows and classes not multiples of EML_BAYES_BATCH_ROWS and EML_BAYES_BATCH_CLASSES
+    n_classes, n_rows = 7, 75
+    X, y = datasets.make_classification(n_classes=n_classes, n_informative=6, n_features=6, n_redundant=0,
+        n_clusters_per_class=1, n_samples=500, random_state=3)
+    X = preprocessing.StandardScaler().fit_transform(X)
+    estimator = GaussianNB().fit(X, y)
+    n_features = X.shape[1]
+
+    wrapper = emlearn.convert(estimator, method='loadable', dtype='q16')
+    code = wrapper.save(name='nb') + f"""
+    #include <stdio.h>
+    {cgen.array_declare('samples', values=X[:n_rows].flatten())}
+    static float out[{n_rows*n_classes}];
+    static float single[{n_classes}];
+    int main() {{
+        if (eml_bayes_log_likelihood_batch(&nb_model, samples, {n_rows}, {n_features},
+                out, {n_rows*n_classes}) != EmlOk) {{
+            return 1;
+        }}
+        // same as one row at a time, and the same class as eml_bayes_predict()
+        for (int r=0; r<{n_rows}; r++) {{
+            const float *row = samples + (r*{n_features});
+            if (eml_bayes_log_likelihood_batch(&nb_model, row, 1, {n_features}, single, {n_classes}) != EmlOk) {{
+                return 2;
+            }}
+            int best = 0;
+            for (int c=0; c<{n_classes}; c++) {{
+                if (single[c] != out[(r*{n_classes})+c]) {{
+                    return 3;
+                }}
+                best = (single[c] > single[best]) ? c : best;
+            }}
+            if (eml_bayes_predict(&nb_model, row, {n_features}) != best) {{
+                return 4;
+            }}
+        }}
+        for (int i=0; i<{n_rows*n_classes}; i++) {{
+            printf("%.9g\\n", out[i]);
+        }}
+        if (eml_bayes_predict_proba_batch(&nb_model, samples, {n_rows}, {n_features},
+                out, {n_rows*n_classes}) != EmlOk) {{
+            return 5;
+        }}
+        for (int i=0; i<{n_rows*n_classes}; i++) {{
+            printf("%.9g\\n", out[i]);
+        }}
+        return 0;
+    }}
+    """
+    src_path = os.path.join(tmp_path, 'batch_q16.c')
+    with open(src_path, 'w') as f:
+        f.write(code)
+    bin_path = common.compile_executable(src_path, str(tmp_path), name='batch_q16',
+        include_dirs=[ common.get_include_dir() ])
+    out = subprocess.check_output([ bin_path ]).decode('utf-8')
+    values = numpy.array([ float(line) for line in out.split() ])
+    log_likelihood = values[:n_rows*n_classes].reshape(n_rows, n_classes)
+    proba = values[n_rows*n_classes:].reshape(n_rows, n_classes)
+
+    # Q16 model has no class priors
+    expect = estimator.predict_joint_log_proba(X[:n_rows]) - numpy.log(estimator.class_prior_)
+    numpy.testing.assert_allclose(log_likelihood, expect, atol=0.1)
+    expect_proba = numpy.exp(log_likelihood - log_likelihood.max(axis=1, keepdims=True))
+    expect_proba /= expect_proba.sum(axis=1, keepdims=True)
+    numpy.testing.assert_allclose(proba, expect_proba, atol=1e-5)
+
+
+def test_bayes_trainer_continues_offline_fit(tmp_path):
+    from emlearn import common, cgen
+
+    X, y = datasets.make_classification(n_classes=3, n_informative=4, n_features=6,
+        n_samples=300, random_state=2)
+    X = preprocessing.StandardScaler().fit_transform(X)
+    n_classes, n_features = 3, X.shape[1]
+    # train offline on the first part, continue on-device with the rest
+    n_offline = 100
+    estimator = GaussianNB().fit(X[:n_offline], y[:n_offline])
+
+    wrapper = emlearn.convert(estimator, method='loadable', dtype='q16')
+    code = wrapper.save(name='nb', trainer=True) + f"""
+    #include <stdio.h>
+    {cgen.array_declare('samples', values=X.flatten())}
+    {cgen.array_declare('labels', values=y, dtype='int32_t')}
+    int main() {{
+        for (int i={n_offline}; i<{len(X)}; i++) {{
+            if (nb_train(samples + (i*{n_features}), {n_features}, labels[i]) != EmlOk) {{
+                return 1;
+            }}
+        }}
+        for (int i=0; i<{len(X)}; i++) {{
+            printf("%d\\n", (int)nb_predict(samples + (i*{n_features}), {n_features}));
+        }}
+        for (int i=0; i<{n_classes*n_features}; i++) {{
+            const EmlBayesSummary s = nb_model.summaries[i];
+            printf("%.9g\\n%.9g\\n", EML_Q16_TOFLOAT(s.mean), EML_Q16_TOFLOAT(s.std));
+        }}
+        return 0;
+    }}
+    """
+    src_path = os.path.join(tmp_path, 'trainer.c')
+    with open(src_path, 'w') as f:
+        f.write(code)
+    bin_path = common.compile_executable(src_path, str(tmp_path), name='trainer',
+        include_dirs=[ common.get_include_dir() ])
+    out = subprocess.check_output([ bin_path ]).decode('utf-8')
+    values = numpy.array([ float(line) for line in out.split() ])
+    pred = values[:len(X)].astype(int)
+    summaries = values[len(X):].reshape(n_classes, n_features, 2)
+
+    # same as statistics over all the data
+    means = numpy.array([ X[y == c].mean(axis=0) for c in range(n_classes) ])
+    variances = numpy.array([ X[y == c].var(axis=0) for c in range(n_classes) ]) + estimator.epsilon_
+    numpy.testing.assert_allclose(summaries[:, :, 0], means, atol=1e-3)
+    numpy.testing.assert_allclose(summaries[:, :, 1], numpy.sqrt(variances), atol=1e-3)
+
+    # Q16 model has no class priors
+    reference = GaussianNB(priors=numpy.ones(n_classes)/n_classes).fit(X, y)
+    agreement = numpy.mean(pred == reference.predict(X))
+    assert agreement > 0.95, agreement
@@ -21,6 +21,7 @@ C_TEST_MODULES = [
     'neighbors',
     'quantizer',
     'net',
+    'fft',
 ]
 
 def parse_test_summary(stdout):
@@ -84,9 +85,8 @@ def c_tests_executable():
 
     yield bin_path
 
-    # cleanup
-    os.unlink(bin_path)
-    os.rmdir(out_dir)
+    # cleanup, including object files
+    shutil.rmtree(out_dir)
 
 
 @pytest.mark.parametrize('module', C_TEST_MODULES)
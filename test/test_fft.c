@@ -0,0 +1,372 @@
+
+#include <eml_fft.h>
+
+#include <unity.h>
+
+#define TEST_FFT_MAX_LENGTH 1024
+
+// Naive DFT, in double precision
+static void
+test_fft_reference(const float *in_real, const float *in_imag, int n, double *out_real, double *out_imag)
+{
+    for (int k=0; k<n; k++) {
+        double re = 0.0;
+        double im = 0.0;
+        for (int t=0; t<n; t++) {
+            const double angle = 2 * M_PI * (double)((k*t) % n) / n;
+            const double x_imag = (in_imag) ? in_imag[t] : 0.0;
+            re += in_real[t] * cos(angle) + x_imag * sin(angle);
+            im += -in_real[t] * sin(angle) + x_imag * cos(angle);
+        }
+        out_real[k] = re;
+        out_imag[k] = im;
+    }
+}
+
+// Deterministic test signal, with some noise
+static float
+test_fft_signal(int i)
+{
+    const float noise = (float)((i * 7919) % 101) / 101.0f - 0.5f;
+    return sinf(0.3f * i) + 0.5f * cosf(1.7f * i) + noise;
+}
+
+void
+test_fft_forward_matches_dft()
+{
+    static float fft_sin[TEST_FFT_MAX_LENGTH/2];
+    static float fft_cos[TEST_FFT_MAX_LENGTH/2];
+    static float real[TEST_FFT_MAX_LENGTH];
+    static float imag[TEST_FFT_MAX_LENGTH];
+    static float in_real[TEST_FFT_MAX_LENGTH];
+    static float in_imag[TEST_FFT_MAX_LENGTH];
+    static double ref_real[TEST_FFT_MAX_LENGTH];
+    static double ref_imag[TEST_FFT_MAX_LENGTH];
+
+    for (int n=2; n<=TEST_FFT_MAX_LENGTH; n*=2) {
+        EmlFFT fft = { n/2, fft_sin, fft_cos };
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_fill(fft, n));
+
+        for (int i=0; i<n; i++) {
+            in_real[i] = test_fft_signal(i);
+            in_imag[i] = test_fft_signal(i+n);
+            real[i] = in_real[i];
+            imag[i] = in_imag[i];
+        }
+        test_fft_reference(in_real, in_imag, n, ref_real, ref_imag);
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_forward(fft, real, imag, n));
+
+        const float tolerance = 1e-4f * n;
+        for (int k=0; k<n; k++) {
+            TEST_ASSERT_FLOAT_WITHIN(tolerance, (float)ref_real[k], real[k]);
+            TEST_ASSERT_FLOAT_WITHIN(tolerance, (float)ref_imag[k], imag[k]);
+        }
+    }
+}
+
+void
+test_fft_rfft_matches_dft()
+{
+    static float fft_sin[TEST_FFT_MAX_LENGTH/2];
+    static float fft_cos[TEST_FFT_MAX_LENGTH/2];
+    static float real[TEST_FFT_MAX_LENGTH];
+    static float imag[TEST_FFT_MAX_LENGTH/2+1];
+    static float in[TEST_FFT_MAX_LENGTH];
+    static double ref_real[TEST_FFT_MAX_LENGTH];
+    static double ref_imag[TEST_FFT_MAX_LENGTH];
+
+    for (int n=2; n<=TEST_FFT_MAX_LENGTH; n*=2) {
+        EmlFFT fft = { n/2, fft_sin, fft_cos };
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_fill(fft, n));
+
+        for (int i=0; i<n; i++) {
+            in[i] = test_fft_signal(i);
+            real[i] = in[i];
+        }
+        test_fft_reference(in, NULL, n, ref_real, ref_imag);
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_rfft(fft, real, imag, n));
+
+        const float tolerance = 1e-4f * n;
+        for (int k=0; k<=n/2; k++) {
+            TEST_ASSERT_FLOAT_WITHIN(tolerance, (float)ref_real[k], real[k]);
+            TEST_ASSERT_FLOAT_WITHIN(tolerance, (float)ref_imag[k], imag[k]);
+        }
+    }
+
+    // Not a power of 2
+    EmlFFT fft = { 3, fft_sin, fft_cos };
+    TEST_ASSERT_EQUAL(EmlSizeMismatch, eml_fft_rfft(fft, real, imag, 6));
+}
+
+void
+test_fft_plan_same_as_forward()
+{
+    static float twiddles[EML_FFT_TWIDDLES_LENGTH(TEST_FFT_MAX_LENGTH)];
+    static uint16_t swaps[EML_FFT_SWAPS_LENGTH(TEST_FFT_MAX_LENGTH)];
+    static float fft_sin[TEST_FFT_MAX_LENGTH/2];
+    static float fft_cos[TEST_FFT_MAX_LENGTH/2];
+    static float real[TEST_FFT_MAX_LENGTH];
+    static float imag[TEST_FFT_MAX_LENGTH];
+    static float ref_real[TEST_FFT_MAX_LENGTH];
+    static float ref_imag[TEST_FFT_MAX_LENGTH];
+
+    // both odd and even number of levels
+    for (int n=2; n<=TEST_FFT_MAX_LENGTH; n*=2) {
+        EmlFFT fft = { n/2, fft_sin, fft_cos };
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_fill(fft, n));
+
+        // complex input
+        EmlFFTPlan plan;
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_init(&plan, EmlFFTComplex, n,
+                    twiddles, EML_FFT_TWIDDLES_LENGTH(n), swaps, EML_FFT_SWAPS_LENGTH(n)));
+        for (int i=0; i<n; i++) {
+            real[i] = ref_real[i] = test_fft_signal(i);
+            imag[i] = ref_imag[i] = test_fft_signal(i+n);
+        }
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_forward(fft, ref_real, ref_imag, n));
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_plan_forward(&plan, real, imag, n));
+        const float tolerance = 1e-5f * n;
+        for (int k=0; k<n; k++) {
+            TEST_ASSERT_FLOAT_WITHIN(tolerance, ref_real[k], real[k]);
+            TEST_ASSERT_FLOAT_WITHIN(tolerance, ref_imag[k], imag[k]);
+        }
+
+        // real input
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_init(&plan, EmlFFTReal, n,
+                    twiddles, EML_FFT_TWIDDLES_LENGTH(n), swaps, EML_FFT_SWAPS_LENGTH(n)));
+        for (int i=0; i<n; i++) {
+            real[i] = ref_real[i] = test_fft_signal(i);
+        }
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_rfft(fft, ref_real, ref_imag, n));
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_plan_rfft(&plan, real, imag, n));
+        for (int k=0; k<=n/2; k++) {
+            TEST_ASSERT_FLOAT_WITHIN(tolerance, ref_real[k], real[k]);
+            TEST_ASSERT_FLOAT_WITHIN(tolerance, ref_imag[k], imag[k]);
+        }
+
+        // wrong plan type
+        TEST_ASSERT_EQUAL(EmlUnsupported, eml_fft_plan_forward(&plan, real, imag, n));
+    }
+}
+
+void
+test_fft_plan_interleaved()
+{
+    static float twiddles[EML_FFT_TWIDDLES_LENGTH(TEST_FFT_MAX_LENGTH)];
+    static uint16_t swaps[EML_FFT_SWAPS_LENGTH(TEST_FFT_MAX_LENGTH)];
+    static float real[TEST_FFT_MAX_LENGTH];
+    static float imag[TEST_FFT_MAX_LENGTH];
+    static float data[2*TEST_FFT_MAX_LENGTH];
+
+    for (int n=2; n<=TEST_FFT_MAX_LENGTH; n*=2) {
+        EmlFFTPlan plan;
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_init(&plan, EmlFFTComplex, n,
+                    twiddles, EML_FFT_TWIDDLES_LENGTH(n), swaps, EML_FFT_SWAPS_LENGTH(n)));
+        for (int i=0; i<n; i++) {
+            real[i] = data[2*i] = test_fft_signal(i);
+            imag[i] = data[2*i+1] = test_fft_signal(i+n);
+        }
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_plan_forward(&plan, real, imag, n));
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_plan_forward_interleaved(&plan, data, n));
+        for (int k=0; k<n; k++) {
+            TEST_ASSERT_FLOAT_WITHIN(1e-6f * n, real[k], data[2*k]);
+            TEST_ASSERT_FLOAT_WITHIN(1e-6f * n, imag[k], data[2*k+1]);
+        }
+    }
+}
+
+#define TEST_FFT_CHANNELS 11
+
+void
+test_fft_plan_channels_same_as_single()
+{
+    const int n = 256;
+    static float twiddles[EML_FFT_TWIDDLES_LENGTH(256)];
+    static uint16_t swaps[EML_FFT_SWAPS_LENGTH(256)];
+    static float real[256*TEST_FFT_CHANNELS];
+    static float imag[256*TEST_FFT_CHANNELS];
+    static float ref_real[256];
+    static float ref_imag[256];
+
+    // fewer, equal and more channels than SIMD lanes. Last one uses stride > n_channels
+    const int channels[4] = { 3, 6, 8, TEST_FFT_CHANNELS };
+    const int strides[4] = { 3, 6, 8, TEST_FFT_CHANNELS };
+
+    for (int type=0; type<2; type++) {
+        const EmlFFTType fft_type = (type == 0) ? EmlFFTComplex : EmlFFTReal;
+        EmlFFTPlan plan;
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_init(&plan, fft_type, n,
+                    twiddles, EML_FFT_TWIDDLES_LENGTH(n), swaps, EML_FFT_SWAPS_LENGTH(n)));
+
+        for (int t=0; t<4; t++) {
+            const int stride = strides[t];
+            // only transform a subset of the channels, starting at channel 1
+            const int n_channels = (t == 3) ? channels[t]-2 : channels[t];
+            const int offset = (t == 3) ? 1 : 0;
+
+            for (int i=0; i<n*stride; i++) {
+                real[i] = test_fft_signal(i);
+                imag[i] = test_fft_signal(i+7);
+            }
+            if (fft_type == EmlFFTComplex) {
+                TEST_ASSERT_EQUAL(EmlOk, eml_fft_plan_forward_channels(&plan,
+                    real+offset, imag+offset, n, stride, n_channels));
+            } else {
+                TEST_ASSERT_EQUAL(EmlOk, eml_fft_plan_rfft_channels(&plan,
+                    real+offset, imag+offset, n, stride, n_channels));
+            }
+
+            for (int c=offset; c<offset+n_channels; c++) {
+                for (int i=0; i<n; i++) {
+                    ref_real[i] = test_fft_signal(i*stride + c);
+                    ref_imag[i] = test_fft_signal(i*stride + c + 7);
+                }
+                const int n_bins = (fft_type == EmlFFTComplex) ? n : n/2+1;
+                if (fft_type == EmlFFTComplex) {
+                    TEST_ASSERT_EQUAL(EmlOk, eml_fft_plan_forward(&plan, ref_real, ref_imag, n));
+                } else {
+                    TEST_ASSERT_EQUAL(EmlOk, eml_fft_plan_rfft(&plan, ref_real, ref_imag, n));
+                }
+                for (int k=0; k<n_bins; k++) {
+                    TEST_ASSERT_FLOAT_WITHIN(1e-6f * n, ref_real[k], real[k*stride + c]);
+                    TEST_ASSERT_FLOAT_WITHIN(1e-6f * n, ref_imag[k], imag[k*stride + c]);
+                }
+            }
+            // channels outside the subset are untouched
+            if (offset > 0) {
+                TEST_ASSERT_EQUAL_FLOAT(test_fft_signal(0), real[0]);
+                TEST_ASSERT_EQUAL_FLOAT(test_fft_signal(stride-1), real[stride-1]);
+            }
+        }
+    }
+}
+
+// Signal-to-noise ratio in dB of out against the reference
+static double
+test_fft_snr(const double *ref_real, const double *ref_imag,
+        const double *out_real, const double *out_imag, int n)
+{
+    double signal = 0.0;
+    double noise = 0.0;
+    for (int k=0; k<n; k++) {
+        const double er = out_real[k] - ref_real[k];
+        const double ei = out_imag[k] - ref_imag[k];
+        signal += ref_real[k]*ref_real[k] + ref_imag[k]*ref_imag[k];
+        noise += er*er + ei*ei;
+    }
+    return 10.0 * log10(signal / noise);
+}
+
+void
+test_fft_fixedpoint_snr()
+{
+    static eml_q15_t cos15[TEST_FFT_MAX_LENGTH/2];
+    static eml_q15_t sin15[TEST_FFT_MAX_LENGTH/2];
+    static eml_q31_t cos31[TEST_FFT_MAX_LENGTH/2];
+    static eml_q31_t sin31[TEST_FFT_MAX_LENGTH/2];
+    static eml_q15_t real15[TEST_FFT_MAX_LENGTH];
+    static eml_q15_t imag15[TEST_FFT_MAX_LENGTH];
+    static eml_q31_t real31[TEST_FFT_MAX_LENGTH];
+    static eml_q31_t imag31[TEST_FFT_MAX_LENGTH];
+    static uint32_t power[TEST_FFT_MAX_LENGTH];
+    static float in_real[TEST_FFT_MAX_LENGTH];
+    static float in_imag[TEST_FFT_MAX_LENGTH];
+    static double ref_real[TEST_FFT_MAX_LENGTH];
+    static double ref_imag[TEST_FFT_MAX_LENGTH];
+    static double ref_power[TEST_FFT_MAX_LENGTH];
+    static double out_real[TEST_FFT_MAX_LENGTH];
+    static double out_imag[TEST_FFT_MAX_LENGTH];
+    static double out_power[TEST_FFT_MAX_LENGTH];
+    static double zeros[TEST_FFT_MAX_LENGTH];
+
+    const int lengths[3] = { 64, 256, 1024 };
+    // small input should not lose precision, with block floating point
+    const float amplitudes[2] = { 0.4f, 0.004f };
+
+    for (int l=0; l<3; l++) {
+    for (int a=0; a<2; a++) {
+        const int n = lengths[l];
+        EmlFFTQ15 table15 = { n/2, sin15, cos15 };
+        EmlFFTQ31 table31 = { n/2, sin31, cos31 };
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_q15_fill(table15, n));
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_q31_fill(table31, n));
+
+        for (int i=0; i<n; i++) {
+            in_real[i] = amplitudes[a] * test_fft_signal(i);
+            in_imag[i] = amplitudes[a] * test_fft_signal(i+n);
+            real15[i] = eml_q15_from_float(in_real[i]);
+            imag15[i] = eml_q15_from_float(in_imag[i]);
+            real31[i] = eml_q31_from_float(in_real[i]);
+            imag31[i] = eml_q31_from_float(in_imag[i]);
+            zeros[i] = 0.0;
+        }
+        // Q15. Compared with the exact DFT of the quantized input
+        for (int i=0; i<n; i++) {
+            in_real[i] = EML_Q15_TOFLOAT(real15[i]);
+            in_imag[i] = EML_Q15_TOFLOAT(imag15[i]);
+        }
+        test_fft_reference(in_real, in_imag, n, ref_real, ref_imag);
+        for (int k=0; k<n; k++) {
+            ref_power[k] = ref_real[k]*ref_real[k] + ref_imag[k]*ref_imag[k];
+        }
+        int exponent = -1;
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_q15_forward(table15, real15, imag15, n, &exponent));
+        TEST_ASSERT_GREATER_OR_EQUAL(0, exponent);
+        const double scale15 = ldexp(1.0, exponent - EML_Q15_FRACT_BITS);
+        for (int k=0; k<n; k++) {
+            out_real[k] = real15[k] * scale15;
+            out_imag[k] = imag15[k] * scale15;
+        }
+        const double snr15 = test_fft_snr(ref_real, ref_imag, out_real, out_imag, n);
+        // each stage adds rounding noise, around 3 dB per doubling of length
+        int levels = 0;
+        for (int temp = n; temp > 1; temp >>= 1) {
+            levels++;
+        }
+        const int min_snr15 = 68 - 2*levels;
+        TEST_ASSERT_GREATER_THAN(min_snr15, (int)snr15);
+
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_q15_power(real15, imag15, power, n));
+        for (int k=0; k<n; k++) {
+            out_power[k] = power[k] * ldexp(1.0, 2*exponent - 30);
+        }
+        TEST_ASSERT_GREATER_THAN(min_snr15, (int)test_fft_snr(ref_power, zeros, out_power, zeros, n));
+
+        // Q31. Float reference input has the same precision as Q31 for these amplitudes
+        for (int i=0; i<n; i++) {
+            in_real[i] = (float)(real31[i] / 2147483648.0);
+            in_imag[i] = (float)(imag31[i] / 2147483648.0);
+        }
+        test_fft_reference(in_real, in_imag, n, ref_real, ref_imag);
+        for (int k=0; k<n; k++) {
+            ref_power[k] = ref_real[k]*ref_real[k] + ref_imag[k]*ref_imag[k];
+        }
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_q31_forward(table31, real31, imag31, n, &exponent));
+        const double scale31 = ldexp(1.0, exponent - EML_Q31_FRACT_BITS);
+        for (int k=0; k<n; k++) {
+            out_real[k] = real31[k] * scale31;
+            out_imag[k] = imag31[k] * scale31;
+        }
+        const double snr31 = test_fft_snr(ref_real, ref_imag, out_real, out_imag, n);
+        TEST_ASSERT_GREATER_THAN(130, (int)snr31);
+
+        TEST_ASSERT_EQUAL(EmlOk, eml_fft_q31_power(real31, imag31, power, n));
+        for (int k=0; k<n; k++) {
+            out_power[k] = power[k] * ldexp(1.0, 2*exponent - 30);
+        }
+        TEST_ASSERT_GREATER_THAN(130, (int)test_fft_snr(ref_power, zeros, out_power, zeros, n));
+    }
+    }
+}
+
+void
+test_eml_fft()
+{
+    // Add tests here
+    RUN_TEST(test_fft_forward_matches_dft);
+    RUN_TEST(test_fft_rfft_matches_dft);
+    RUN_TEST(test_fft_plan_same_as_forward);
+    RUN_TEST(test_fft_plan_interleaved);
+    RUN_TEST(test_fft_fixedpoint_snr);
+    RUN_TEST(test_fft_plan_channels_same_as_single);
+}
@@ -80,3 +80,219 @@ def test_gaussian_mixture_equals_sklearn(data, model, method):
         os.makedirs(out_dir)
     cmodel.save(file=save_path, name='my_test_model')
 
+
+@pytest.mark.parametrize("covariance_type", ['full', 'tied', 'diag', 'spherical'])
+def test_gaussian_mixture_native_covariance(covariance_type):
+    X, y = DATASETS['5way']
+    X = preprocessing.StandardScaler().fit_transform(X)
+    estimator = GaussianMixture(n_components=3, covariance_type=covariance_type, random_state=random)
+    estimator.fit(X)
+
+    cmodel = emlearn.convert(estimator, method='inline')
+    code = cmodel.save(name='native')
+
+    # covariance type is kept, instead of expanding into full precision matrices
+    c_type = emlearn.mixture.get_covariance_type(covariance_type)
+    assert c_type in code
+    n_features = X.shape[1]
+    n_precisions = estimator.precisions_cholesky_.size
+    if covariance_type in ('full', 'tied'):
+        # only the upper triangle of the Cholesky factors is stored
+        n_precisions = (n_precisions // (n_features*n_features)) * (n_features*(n_features+1)//2)
+        assert 'native_mean_projections' in code
+    assert f'native_precisions[{n_precisions}]' in code
+
+    expect = estimator.score_samples(X[:10])
+    numpy.testing.assert_allclose(cmodel.score_samples(X[:10]), expect, rtol=1e-5)
+
+    # dense precisions, means projected for each sample
+    cmodel.pack_precisions = False
+    cmodel.project_means = False
+    numpy.testing.assert_allclose(cmodel.score_samples(X[:10]), expect, rtol=1e-5)
+
+
+@pytest.mark.parametrize("covariance_type", ['full', 'tied', 'diag', 'spherical'])
+def test_gaussian_mixture_score_batch(covariance_type, tmp_path):
+    from emlearn import mixture, common, cgen
+
+    X, y = DATASETS['5way']
+    X = preprocessing.StandardScaler().fit_transform(X)
+    estimator = GaussianMixture(n_components=3, covariance_type=covariance_type, random_state=random)
+    estimator.fit(X)
+
+    # not a multiple of the block size
+    n_samples, n_features = 19, X.shape[1]
+    wrapper = emlearn.convert(estimator, method='inline')
+    code = mixture.generate_code(wrapper, name='batch') + f"""
+    #include <stdio.h>
+    {cgen.array_declare('samples', values=X[:n_samples].flatten())}
+    static float probabilities[{n_samples*3}];
+    static float scores[{n_samples}];
+    int main() {{
+        const int32_t err = batch_score_batch(samples, {n_samples}, {n_features}, probabilities, scores);
+        if (err != EmlOk) {{
+            return 1;
+        }}
+        for (int i=0; i<{n_samples}; i++) {{
+            printf("%.9g\\n", scores[i]);
+        }}
+        return 0;
+    }}
+    """
+    src_path = os.path.join(tmp_path, 'batch.c')
+    with open(src_path, 'w') as f:
+        f.write(code)
+    bin_path = common.compile_executable(src_path, str(tmp_path), name='batch',
+        include_dirs=[ common.get_include_dir() ])
+    out = subprocess.check_output([ bin_path ]).decode('utf-8')
+    scores = numpy.array([ float(line) for line in out.split() ])
+
+    expect = estimator.score_samples(X[:n_samples])
+    # float32 accumulation, scores close to 0 need an absolute tolerance
+    numpy.testing.assert_allclose(scores, expect, rtol=1e-5, atol=1e-5)
+
+
+def online_em_reference(estimator, X, step_size, min_variance):
+    """Stepwise EM, same update rules as eml_mixture_update(). In float64"""
+    from scipy.stats import multivariate_normal
+    from scipy.special import logsumexp
+
+    n_components, n_features = estimator.means_.shape
+    means = estimator.means_.copy()
+    weights = estimator.weights_.copy()
+    covariances = estimator.covariances_.copy()
+    covariance_type = estimator.covariance_type
+
+    def full_covariance(c):
+        if covariance_type == 'full':
+            return covariances[c]
+        elif covariance_type == 'diag':
+            return numpy.diag(covariances[c])
+        else:
+            return covariances[c] * numpy.eye(n_features)
+
+    def log_proba(x):
+        return numpy.array([ numpy.log(weights[c]) + multivariate_normal.logpdf(x, means[c], full_covariance(c))
+            for c in range(n_components) ])
+
+    for x in X:
+        lp = log_proba(x)
+        resp = numpy.exp(lp - logsumexp(lp))
+        for c in range(n_components):
+            weights[c] = (1 - step_size) * weights[c] + step_size * resp[c]
+            rate = step_size * resp[c] / weights[c]
+            if rate < 1e-6:
+                continue
+            rate = min(rate, 0.5) # same limit as eml_mixture_update()
+            d = x - means[c]
+            means[c] += rate * d
+            if covariance_type == 'full':
+                covariances[c] = (1 - rate) * (covariances[c] + rate * numpy.outer(d, d))
+            elif covariance_type == 'diag':
+                covariances[c] = numpy.maximum((1 - rate) * (covariances[c] + rate * d * d), min_variance)
+            else:
+                v = (1 - rate) * (covariances[c] + rate * numpy.sum(d * d) / n_features)
+                covariances[c] = max(v, min_variance)
+
+    def score_samples(X):
+        return numpy.array([ logsumexp(log_proba(x)) for x in X ])
+
+    return means, score_samples
+
+
+@pytest.mark.parametrize("covariance_type", ['full', 'diag', 'spherical'])
+def test_gaussian_mixture_online_update(covariance_type, tmp_path):
+    from emlearn import mixture, common, cgen
+
+    X, y = DATASETS['5way']
+    X = preprocessing.StandardScaler().fit_transform(X)
+    X = decomposition.PCA(3, random_state=random).fit_transform(X)
+    estimator = GaussianMixture(n_components=3, covariance_type=covariance_type, random_state=random)
+    estimator.fit(X)
+
+    # drifted data
+    rng = numpy.random.RandomState(3)
+    stream = X[rng.randint(0, len(X), size=200)] + 0.5
+    step_size = 0.05
+    n_components, n_features = estimator.means_.shape
+
+    wrapper = emlearn.convert(estimator, method='inline')
+    code = mixture.generate_code(wrapper, name='gmm', online=True, step_size=step_size)
+    code += f"""
+    #include <stdio.h>
+    {cgen.array_declare('stream', values=stream.flatten())}
+    {cgen.array_declare('test', values=X.flatten())}
+    static float probabilities[{n_components}];
+    int main() {{
+        for (int i=0; i<{len(stream)}; i++) {{
+            if (gmm_update(stream + (i*{n_features}), {n_features}) != EmlOk) {{
+                return 1;
+            }}
+        }}
+        for (int i=0; i<{n_components*n_features}; i++) {{
+            printf("%.9g\\n", gmm_means[i]);
+        }}
+        for (int i=0; i<{len(X)}; i++) {{
+            float score = 0.0f;
+            if (gmm_score(test + (i*{n_features}), {n_features}, probabilities, &score) != EmlOk) {{
+                return 2;
+            }}
+            printf("%.9g\\n", score);
+        }}
+        return 0;
+    }}
+    """
+    src_path = os.path.join(tmp_path, 'online.c')
+    with open(src_path, 'w') as f:
+        f.write(code)
+    bin_path = common.compile_executable(src_path, str(tmp_path), name='online',
+        include_dirs=[ common.get_include_dir() ])
+    out = subprocess.check_output([ bin_path ]).decode('utf-8')
+    values = numpy.array([ float(line) for line in out.split() ])
+    means = values[:n_components*n_features].reshape(n_components, n_features)
+    scores = values[n_components*n_features:]
+
+    with numpy.errstate(under='ignore'):
+        expect_means, expect_score = online_em_reference(estimator, stream, step_size, min_variance=1e-6)
+        expect_scores = expect_score(X)
+    numpy.testing.assert_allclose(means, expect_means, atol=1e-3)
+    numpy.testing.assert_allclose(scores, expect_scores, rtol=1e-3, atol=1e-3)
+
+    # model has adapted towards the drifted data
+    assert numpy.mean(scores) < numpy.mean(estimator.score_samples(X))
+
+def test_gaussian_mixture_online_update_error_keeps_model(tmp_path):
+    from emlearn import mixture, common, cgen
+
+    X, y = DATASETS['5way']
+    X = preprocessing.StandardScaler().fit_transform(X)
+    X = decomposition.PCA(3, random_state=random).fit_transform(X)
+    estimator = GaussianMixture(n_components=3, covariance_type='full', random_state=random)
+    estimator.fit(X)
+
+    wrapper = emlearn.convert(estimator, method='inline')
+    code = mixture.generate_code(wrapper, name='gmm', online=True)
+    arrays = [ 'gmm_means', 'gmm_precisions', 'gmm_log_dets', 'gmm_log_weights' ]
+    copies = '\n'.join(f'static float copy_{a}[sizeof({a})/sizeof(float)];' for a in arrays)
+    save = '\n'.join(f'memcpy(copy_{a}, {a}, sizeof({a}));' for a in arrays)
+    compare = '\n'.join(f'if (memcmp(copy_{a}, {a}, sizeof({a}))) {{ return 2; }}' for a in arrays)
+    code += f"""
+    #include <string.h>
+    {copies}
+    int main() {{
+        {save}
+        // so far from the model that the Cholesky downdate fails
+        const float outlier[3] = {{ 1e20f, 0.0f, 0.0f }};
+        if (gmm_update(outlier, 3) != -EmlUnknownError) {{
+            return 1;
+        }}
+        {compare}
+        return 0;
+    }}
+    """
+    src_path = os.path.join(tmp_path, 'online_error.c')
+    with open(src_path, 'w') as f:
+        f.write(code)
+    bin_path = common.compile_executable(src_path, str(tmp_path), name='online_error',
+        include_dirs=[ common.get_include_dir() ])
+    assert subprocess.call([ bin_path ]) == 0
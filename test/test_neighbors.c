@@ -42,7 +42,8 @@ test_neighbors_simple()
     const int K_NEIGHBORS = 1;
 
     // Setup model
-    EmlNeighborsModel _model = { N_FEATURES, 0, MAX_ITEMS, data, labels, K_NEIGHBORS };
+    EmlNeighborsModel _model = { N_FEATURES, 0, MAX_ITEMS, data, labels, K_NEIGHBORS,
+        NULL, 0, 0, NULL, 0, 0, 0, EmlNeighborsWeightUniform, NULL };
     EmlNeighborsModel *model = &_model;
     err = eml_neighbors_check(model, DATA_LENGTH, MAX_ITEMS, MAX_ITEMS);
     TEST_ASSERT_EQUAL(EmlOk, err);
@@ -71,9 +72,392 @@ test_neighbors_simple()
     TEST_ASSERT_EQUAL(class2_label, out_label);
 }
 
+void
+test_neighbors_topk_select()
+{
+    // Top-k selection must give the same k items as a full sort
+
+    #define TOPK_ITEMS 57
+    EmlNeighborsDistanceItem distances[TOPK_ITEMS];
+    EmlNeighborsDistanceItem heap[TOPK_ITEMS];
+
+    const int ks[] = { 1, 2, 5, 16, TOPK_ITEMS };
+    for (int k_no=0; k_no<(int)(sizeof(ks)/sizeof(ks[0])); k_no++) {
+        const int k = ks[k_no];
+
+        // pseudo-random distances, with duplicates
+        int found = 0;
+        for (int i=0; i<TOPK_ITEMS; i++) {
+            distances[i].index = i;
+            distances[i].distance = (uint32_t)((i * 7919) % 23);
+            eml_neighbors_topk_push(heap, &found, k, distances[i]);
+        }
+        eml_neighbors_topk_sort(heap, found);
+        TEST_ASSERT_EQUAL(k, found);
+
+        EmlError err = eml_neighbors_select_nearest(distances, TOPK_ITEMS, k);
+        TEST_ASSERT_EQUAL(EmlOk, err);
+
+        for (int i=0; i<k; i++) {
+            // ascending by distance, then index
+            if (i > 0) {
+                TEST_ASSERT_TRUE(EML_NEIGHBORS_ITEM_LESS(distances[i-1], distances[i]));
+            }
+            TEST_ASSERT_EQUAL(heap[i].index, distances[i].index);
+            TEST_ASSERT_EQUAL(heap[i].distance, distances[i].distance);
+        }
+        // everything not selected is at least as far as the k-th
+        for (int i=k; i<TOPK_ITEMS; i++) {
+            TEST_ASSERT_TRUE(EML_NEIGHBORS_ITEM_LESS(distances[k-1], distances[i]));
+        }
+    }
+    #undef TOPK_ITEMS
+}
+
+void
+test_neighbors_predict_small_buffer()
+{
+    // Prediction only needs storage for k items, not all of them
+
+    int16_t data[DATA_LENGTH];
+    int16_t labels[MAX_ITEMS];
+    const int K_NEIGHBORS = 3;
+    EmlNeighborsDistanceItem distances[3];
+
+    EmlNeighborsModel _model = { N_FEATURES, 0, MAX_ITEMS, data, labels, K_NEIGHBORS,
+        NULL, 0, 0, NULL, 0, 0, 0, EmlNeighborsWeightUniform, NULL };
+    EmlNeighborsModel *model = &_model;
+    EmlError err = eml_neighbors_check(model, DATA_LENGTH, MAX_ITEMS, K_NEIGHBORS);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+
+    for (int i=0; i<MAX_ITEMS; i++) {
+        const int16_t label = i % 2;
+        const int16_t values[N_FEATURES] = { (int16_t)(i*10), (int16_t)(label*100), 0 };
+        err = eml_neighbors_add_item(model, values, N_FEATURES, label);
+        TEST_ASSERT_EQUAL(EmlOk, err);
+    }
+
+    const int16_t query[N_FEATURES] = { 500, 100, 0 };
+    int16_t out_label = -1;
+    err = eml_neighbors_predict(model, query, N_FEATURES, distances, K_NEIGHBORS, &out_label);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_EQUAL(1, out_label);
+
+    // too small buffer is rejected
+    err = eml_neighbors_predict(model, query, N_FEATURES, distances, K_NEIGHBORS-1, &out_label);
+    TEST_ASSERT_EQUAL(EmlSizeMismatch, err);
+}
+
+void
+test_neighbors_distance_extremes()
+{
+    // Squared distance must be exact, also when differences do not fit in int16
+
+    #define DIST_FEATURES 37
+    int16_t a[DIST_FEATURES];
+    int16_t b[DIST_FEATURES];
+
+    for (int round=0; round<4; round++) {
+        uint64_t expect = 0;
+        for (int i=0; i<DIST_FEATURES; i++) {
+            const int32_t r = (i * 7919 + round * 104729) % 65536;
+            a[i] = (int16_t)(r - 32768);
+            b[i] = (round == 0) ? INT16_MAX : (int16_t)(32767 - r);
+            if (round == 3) {
+                // small values, takes the int16 fast path
+                a[i] = (int16_t)(i - 20);
+                b[i] = (int16_t)(3*i);
+            }
+            const int64_t diff = (int64_t)a[i] - (int64_t)b[i];
+            expect += (uint64_t)(diff * diff);
+        }
+        const EmlNeighborsDistance d = eml_distance_sqeuclidean_int16(a, b, DIST_FEATURES);
+        // in 32 bit mode, accumulation is modulo 2^32
+        TEST_ASSERT_TRUE(d == (EmlNeighborsDistance)expect);
+    }
+    #undef DIST_FEATURES
+
+    // Integer square root, including the edges of the range
+    const EmlNeighborsDistance max = (EmlNeighborsDistance)-1;
+    const EmlNeighborsDistance roots[] = { 0, 1, 2, 3, 4, 15, 16, 17, 65535, 65536, 4294836225u, max };
+    for (int i=0; i<(int)(sizeof(roots)/sizeof(roots[0])); i++) {
+        const EmlNeighborsDistance x = roots[i];
+        const EmlNeighborsDistance r = eml_neighbors_isqrt(x);
+        TEST_ASSERT_TRUE(r*r <= x);
+        TEST_ASSERT_TRUE((r+1)*(r+1) > x || (r+1)*(r+1) < r); // wraparound at the top of range
+    }
+}
+
+void
+test_neighbors_distance_bounded()
+{
+    // Bounded distance is exact up to the limit, and larger than limit otherwise
+
+    #define BOUNDED_FEATURES 50
+    int16_t a[BOUNDED_FEATURES];
+    int16_t b[BOUNDED_FEATURES];
+    for (int i=0; i<BOUNDED_FEATURES; i++) {
+        a[i] = (int16_t)(i*3);
+        b[i] = (int16_t)(100 - i);
+    }
+    const EmlNeighborsDistance full = eml_distance_sqeuclidean_int16(a, b, BOUNDED_FEATURES);
+
+    const EmlNeighborsDistance limits[] = { 0, 1, 1000, full-1, full, full+1, (EmlNeighborsDistance)-1 };
+    for (int i=0; i<(int)(sizeof(limits)/sizeof(limits[0])); i++) {
+        const EmlNeighborsDistance limit = limits[i];
+        const EmlNeighborsDistance d = \
+            eml_distance_sqeuclidean_int16_bounded(a, b, BOUNDED_FEATURES, limit);
+        if (full <= limit) {
+            TEST_ASSERT_TRUE(d == full);
+        } else {
+            TEST_ASSERT_TRUE(d > limit);
+        }
+    }
+    #undef BOUNDED_FEATURES
+}
+
+void
+test_neighbors_replace_items()
+{
+    // Replacing items when full must keep the items covered by the KD-tree
+
+    #define REPLACE_ITEMS 8
+    #define REPLACE_TREE_ITEMS 4
+    int16_t data[REPLACE_ITEMS*N_FEATURES];
+    int16_t labels[REPLACE_ITEMS];
+    const EmlNeighborsTreeNode tree[1] = { { -1, 0, 0, REPLACE_TREE_ITEMS } };
+    EmlNeighborsModel model = { N_FEATURES, 0, REPLACE_ITEMS, data, labels, 1,
+        NULL, 0, 0, NULL, 0, 0, 0, EmlNeighborsWeightUniform, NULL };
+    EmlError err = EmlOk;
+
+    for (int i=0; i<REPLACE_TREE_ITEMS; i++) {
+        const int16_t values[N_FEATURES] = { (int16_t)(100*i), 0, 0 };
+        err = eml_neighbors_add_item(&model, values, N_FEATURES, 0);
+        TEST_ASSERT_EQUAL(EmlOk, err);
+    }
+    model.tree_nodes = tree;
+    model.tree_n_nodes = 1;
+    model.tree_items = REPLACE_TREE_ITEMS;
+
+    // FIFO cycles through the slots after the tree
+    for (int i=0; i<20; i++) {
+        const int16_t values[N_FEATURES] = { 0, (int16_t)i, 0 };
+        int16_t index = -1;
+        err = eml_neighbors_add_item_fifo(&model, values, N_FEATURES, 1, &index);
+        TEST_ASSERT_EQUAL(EmlOk, err);
+        const int expect = (i < REPLACE_ITEMS-REPLACE_TREE_ITEMS) ? \
+            REPLACE_TREE_ITEMS+i : REPLACE_TREE_ITEMS + ((i-REPLACE_TREE_ITEMS) % (REPLACE_ITEMS-REPLACE_TREE_ITEMS));
+        TEST_ASSERT_EQUAL(expect, index);
+        TEST_ASSERT_EQUAL(values[1], data[index*N_FEATURES+1]);
+    }
+    TEST_ASSERT_EQUAL(REPLACE_ITEMS, model.n_items);
+    for (int i=0; i<REPLACE_TREE_ITEMS; i++) {
+        TEST_ASSERT_EQUAL(100*i, data[i*N_FEATURES]);
+        TEST_ASSERT_EQUAL(0, labels[i]);
+    }
+
+    // Reservoir only stores into the slots after the tree
+    int stored = 0;
+    uint32_t random = 1;
+    for (int i=0; i<200; i++) {
+        const int16_t values[N_FEATURES] = { 0, 0, (int16_t)i };
+        int16_t index = -1;
+        random = random * 1103515245 + 12345;
+        err = eml_neighbors_add_item_reservoir(&model, values, N_FEATURES, 1, random >> 8, &index);
+        TEST_ASSERT_EQUAL(EmlOk, err);
+        if (index >= 0) {
+            TEST_ASSERT_TRUE(index >= REPLACE_TREE_ITEMS && index < REPLACE_ITEMS);
+            stored += 1;
+        }
+    }
+    TEST_ASSERT_TRUE(stored > 0 && stored < 50);
+    TEST_ASSERT_EQUAL(REPLACE_ITEMS, model.n_items);
+
+    // Items covered by the tree cannot be removed
+    err = eml_neighbors_remove_item(&model, 1);
+    TEST_ASSERT_EQUAL(EmlSizeMismatch, err);
+    const int16_t last_value = data[(REPLACE_ITEMS-1)*N_FEATURES+2];
+    err = eml_neighbors_remove_item(&model, REPLACE_TREE_ITEMS);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_EQUAL(REPLACE_ITEMS-1, model.n_items);
+    TEST_ASSERT_EQUAL(last_value, data[REPLACE_TREE_ITEMS*N_FEATURES+2]);
+
+    #undef REPLACE_ITEMS
+    #undef REPLACE_TREE_ITEMS
+}
+
+void
+test_neighbors_merge_condensed()
+{
+    #define MERGE_ITEMS 10
+    int16_t data[MERGE_ITEMS*N_FEATURES];
+    int16_t labels[MERGE_ITEMS];
+    EmlNeighborsDistanceItem distances[1];
+    EmlNeighborsModel model = { N_FEATURES, 0, MERGE_ITEMS, data, labels, 1,
+        NULL, 0, 0, NULL, 0, 0, 0, EmlNeighborsWeightUniform, NULL };
+    EmlError err = EmlOk;
+    int16_t index = -1;
+
+    const int16_t a[N_FEATURES] = { 10, 10, 10 };
+    const int16_t b[N_FEATURES] = { 100, 100, 100 };
+    err = eml_neighbors_add_item(&model, a, N_FEATURES, 0);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    err = eml_neighbors_add_item(&model, b, N_FEATURES, 1);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+
+    // Near-duplicate with same label is merged into the midpoint
+    const int16_t near_a[N_FEATURES] = { 14, 10, 6 };
+    err = eml_neighbors_merge_item(&model, near_a, N_FEATURES, 0, 50, &index);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_EQUAL(0, index);
+    TEST_ASSERT_EQUAL(12, data[0]);
+    TEST_ASSERT_EQUAL(8, data[2]);
+
+    // Not merged with a different label, or too far away
+    err = eml_neighbors_merge_item(&model, near_a, N_FEATURES, 1, 50, &index);
+    TEST_ASSERT_EQUAL(-1, index);
+    err = eml_neighbors_merge_item(&model, near_a, N_FEATURES, 0, 2, &index);
+    TEST_ASSERT_EQUAL(-1, index);
+    TEST_ASSERT_EQUAL(2, model.n_items);
+
+    // Correctly classified items are not stored
+    err = eml_neighbors_add_item_condensed(&model, near_a, N_FEATURES, 0, distances, 1, &index);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_EQUAL(-1, index);
+    TEST_ASSERT_EQUAL(2, model.n_items);
+    err = eml_neighbors_add_item_condensed(&model, near_a, N_FEATURES, 2, distances, 1, &index);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_EQUAL(2, index);
+    TEST_ASSERT_EQUAL(3, model.n_items);
+
+    #undef MERGE_ITEMS
+}
+
+void
+test_neighbors_vote_modes()
+{
+    // Labels beyond the old fixed class limit, weighted voting, regression and outlier score
+    #define VOTE_ITEMS 4
+    int16_t data[VOTE_ITEMS*N_FEATURES] = {
+        0, 0, 0,
+        3, 0, 0,
+        4, 0, 0,
+        100, 0, 0,
+    };
+    int16_t labels[VOTE_ITEMS] = { 50, 20, 20, 7 };
+    EmlNeighborsDistanceItem distances[3];
+    EmlNeighborsModel model = { N_FEATURES, VOTE_ITEMS, VOTE_ITEMS, data, labels, 3,
+        NULL, 0, 0, NULL, 0, 0, 0, EmlNeighborsWeightUniform, NULL };
+    const int16_t query[N_FEATURES] = { 1, 0, 0 };
+    EmlError err = EmlOk;
+    int16_t out = -1;
+    float value = 0.0f;
+
+    // uniform: 2 votes for 20
+    err = eml_neighbors_predict(&model, query, N_FEATURES, distances, 3, &out);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_EQUAL(20, out);
+
+    // distance: 1/1 for 50, 1/2+1/3 for 20
+    model.weighting = EmlNeighborsWeightDistance;
+    err = eml_neighbors_predict(&model, query, N_FEATURES, distances, 3, &out);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_EQUAL(50, out);
+
+    float proba[51];
+    model.n_classes = 51;
+    err = eml_neighbors_predict_proba(&model, query, N_FEATURES, distances, 3, proba, 51);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 1.0f/(1.0f+0.5f+1.0f/3), proba[50]);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 0.0f, proba[7]);
+    err = eml_neighbors_predict_proba(&model, query, N_FEATURES, distances, 3, proba, 10);
+    TEST_ASSERT_EQUAL(EmlSizeMismatch, err);
+
+    model.weighting = EmlNeighborsWeightUniform;
+    err = eml_neighbors_regress(&model, query, N_FEATURES, distances, 3, &value);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 30.0f, value);
+
+    err = eml_neighbors_outlier_score(&model, query, N_FEATURES, distances, 3, &value);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 3.0f, value);
+
+    #undef VOTE_ITEMS
+}
+
+void
+test_neighbors_batch_same_as_single()
+{
+    // Batched queries must give the same nearest items as one query at a time
+    #define BATCH_ITEMS 200
+    #define BATCH_FEATURES 5
+    #define BATCH_QUERIES 13
+    #define BATCH_K 4
+    int16_t data[BATCH_ITEMS*BATCH_FEATURES];
+    int16_t labels[BATCH_ITEMS];
+    int16_t queries[BATCH_QUERIES*BATCH_FEATURES];
+    const int16_t order[BATCH_FEATURES] = { 3, 0, 4, 1, 2 };
+    EmlNeighborsDistanceItem batch[BATCH_QUERIES*BATCH_K];
+    EmlNeighborsDistanceItem single[BATCH_K];
+    int16_t predicted[BATCH_QUERIES];
+
+    uint32_t state = 7;
+    for (int i=0; i<BATCH_ITEMS*BATCH_FEATURES; i++) {
+        state = state * 1103515245 + 12345;
+        data[i] = (int16_t)((state >> 16) % 200) - 100;
+    }
+    for (int i=0; i<BATCH_ITEMS; i++) {
+        labels[i] = i % 3;
+    }
+    for (int i=0; i<BATCH_QUERIES*BATCH_FEATURES; i++) {
+        state = state * 1103515245 + 12345;
+        queries[i] = (int16_t)((state >> 16) % 200) - 100;
+    }
+
+    EmlNeighborsModel model = { BATCH_FEATURES, BATCH_ITEMS, BATCH_ITEMS, data, labels, BATCH_K,
+        NULL, 0, 0, NULL, 0, 0, 0, EmlNeighborsWeightUniform, NULL };
+    for (int ordered=0; ordered<2; ordered++) {
+        model.feature_order = (ordered) ? order : NULL;
+
+        EmlError err = eml_neighbors_predict_batch(&model, queries, BATCH_QUERIES, BATCH_FEATURES,
+                batch, BATCH_QUERIES*BATCH_K, predicted, BATCH_QUERIES);
+        TEST_ASSERT_EQUAL(EmlOk, err);
+
+        for (int q=0; q<BATCH_QUERIES; q++) {
+            int16_t label = -1;
+            err = eml_neighbors_predict(&model, queries + (q*BATCH_FEATURES), BATCH_FEATURES,
+                    single, BATCH_K, &label);
+            TEST_ASSERT_EQUAL(EmlOk, err);
+            TEST_ASSERT_EQUAL(label, predicted[q]);
+            for (int i=0; i<BATCH_K; i++) {
+                TEST_ASSERT_EQUAL(single[i].index, batch[(q*BATCH_K)+i].index);
+                TEST_ASSERT_TRUE(single[i].distance == batch[(q*BATCH_K)+i].distance);
+            }
+        }
+    }
+
+    // Output must have room for all queries
+    const EmlError err = eml_neighbors_infer_nearest_batch(&model, queries, BATCH_QUERIES, BATCH_FEATURES,
+            BATCH_K, batch, (BATCH_QUERIES*BATCH_K)-1);
+    TEST_ASSERT_EQUAL(EmlSizeMismatch, err);
+
+    #undef BATCH_ITEMS
+    #undef BATCH_FEATURES
+    #undef BATCH_QUERIES
+    #undef BATCH_K
+}
+
 void
 test_eml_neighbors()
 {
     // Add tests here
     RUN_TEST(test_neighbors_simple);
+    RUN_TEST(test_neighbors_topk_select);
+    RUN_TEST(test_neighbors_predict_small_buffer);
+    RUN_TEST(test_neighbors_distance_extremes);
+    RUN_TEST(test_neighbors_distance_bounded);
+    RUN_TEST(test_neighbors_replace_items);
+    RUN_TEST(test_neighbors_merge_condensed);
+    RUN_TEST(test_neighbors_vote_modes);
+    RUN_TEST(test_neighbors_batch_same_as_single);
 }
@@ -21,7 +21,6 @@ UNSUPPORTED_PARAMS={
     'p=1 (manhattan)': dict(p=1), # manhattan
     'metric=manhattan': dict(metric='manhattan'),
     'generic minowski': dict(p=2.23),
-    'weighted distance': dict(weights='distance'),
     'custom distance': dict(weights=lambda x: x),
 }
 
@@ -38,8 +37,8 @@ def test_unsupported_classifier(name):
     assert 'Unsupported ' in str(ex.value)
 
 
-def assert_equivalent(model, X_test, n_classes, method):
-    cmodel = emlearn.convert(model, method=method)
+def assert_equivalent(model, X_test, n_classes, method, **kwargs):
+    cmodel = emlearn.convert(model, method=method, **kwargs)
 
     # TODO: support predict_proba, use that instead
     cpred = cmodel.predict(X_test)
@@ -47,9 +46,13 @@ def assert_equivalent(model, X_test, n_classes, method):
 
     assert_equal(pred, cpred)
 
+    proba = model.predict_proba(X_test)
+    cproba = cmodel.predict_proba(X_test)
+    assert_almost_equal(proba, cproba, decimal=5)
 
 
-def make_classification_dataset(n_features=10, n_classes=10):
+
+def make_classification_dataset(n_features=10, n_classes=10, out_max=10000):
 
     rng = numpy.random.RandomState(0)
     X, y = make_classification(n_features=n_features, n_classes=n_classes,
@@ -58,8 +61,7 @@ def make_classification_dataset(n_features=10, n_classes=10):
     X += 2 * rng.uniform(size=X.shape)
 
     X = StandardScaler().fit_transform(X)
-    # FIXME: fails when values are larger
-    X = Quantizer(out_max=10000).fit_transform(X)
+    X = Quantizer(out_max=out_max).fit_transform(X)
 
     X_train, X_test, y_train, y_test = train_test_split(X, y, test_size=.2)
     return X_train, X_test, y_train, y_test
@@ -69,6 +71,9 @@ SUPPORTED_PARAMS = {
     'metric=euclidean': dict(metric='euclidean'),
     'NN1': dict(n_neighbors=1),
     'NN5': dict(n_neighbors=5),
+    'kd_tree': dict(n_neighbors=5, algorithm='kd_tree', leaf_size=3),
+    'brute': dict(n_neighbors=5, algorithm='brute'),
+    'weights=distance': dict(n_neighbors=5, weights='distance'),
 }
 
 @pytest.mark.parametrize('params', SUPPORTED_PARAMS)
@@ -88,4 +93,117 @@ def test_classifier_predict(params):
 
     assert_equivalent(model, X_test, n_classes, method='loadable')
 
+def test_classifier_predict_large_values():
+    # differences larger than int16, squared distances larger than 32 bit
+    model = KNeighborsClassifier(n_neighbors=3)
+    X_train, X_test, y_train, y_test = make_classification_dataset(out_max=32767)
+    model.fit(X_train, y_train)
+
+    code = emlearn.convert(model, method='loadable').save(name='large')
+    assert 'EML_NEIGHBORS_DISTANCE_64 1' in code
+
+    assert_equivalent(model, X_test[:10], 10, method='loadable')
+
+@pytest.mark.parametrize('algorithm', ['brute', 'kd_tree'])
+def test_classifier_reorder_features(algorithm):
+    # many features, so that distance computations get abandoned
+    model = KNeighborsClassifier(n_neighbors=3, algorithm=algorithm, leaf_size=5)
+    X_train, X_test, y_train, y_test = make_classification_dataset(n_features=40)
+    X_train[:, 5] *= 3 # give one feature the highest variance
+    model.fit(X_train, y_train)
 
+    code = emlearn.convert(model, method='loadable', reorder_features=True).save(name='ordered')
+    assert 'ordered_feature_order[40] = { 5,' in code
+
+    assert_equivalent(model, X_test[:10], 10, method='loadable', reorder_features=True)
+
+def test_kdtree_same_as_brute():
+    from emlearn import neighbors, common
+
+    rng = numpy.random.RandomState(1)
+    # few distinct values, so that many distances are tied
+    X = rng.randint(-20, 20, size=(300, 3))
+    y = rng.randint(0, 4, size=len(X))
+    k = 7
+
+    code = neighbors.c_generate_neighbors(X, y, n_neighbors=k, prefix='kdtree',
+        algorithm='kd_tree', leaf_size=4)
+    assert 'EmlNeighborsTreeNode kdtree_tree' in code
+
+    # Returns 1 when KD-tree and brute-force give the same k nearest
+    code += f"""
+    int compare_tree_brute(const float *values, int length) {{
+        int16_t features[3];
+        for (int i=0; i<length; i++) {{
+            features[i] = (int16_t)values[i];
+        }}
+        EmlNeighborsDistanceItem tree[{k}];
+        EmlNeighborsDistanceItem brute[{k}];
+
+        EmlNeighborsModel brute_model = kdtree;
+        brute_model.tree_nodes = NULL;
+        if (eml_neighbors_infer_nearest(&kdtree, features, length, {k}, tree, {k}) != EmlOk) {{
+            return -1;
+        }}
+        if (eml_neighbors_infer_nearest(&brute_model, features, length, {k}, brute, {k}) != EmlOk) {{
+            return -2;
+        }}
+        for (int i=0; i<{k}; i++) {{
+            if (tree[i].index != brute[i].index || tree[i].distance != brute[i].distance) {{
+                return 0;
+            }}
+        }}
+        return 1;
+    }}
+    """
+    cmodel = common.CompiledClassifier(code, name='kdtree_compare', call='compare_tree_brute(values, length)')
+
+    queries = rng.randint(-30, 30, size=(100, 3))
+    assert_equal(cmodel.predict(queries), numpy.ones(len(queries)))
+
+def test_too_many_items():
+    from emlearn import neighbors
+
+    X = numpy.zeros(shape=(neighbors.INT16_MAX+1, 2), dtype=int)
+    y = numpy.zeros(shape=len(X), dtype=int)
+    with pytest.raises(ValueError, match='Too many items'):
+        neighbors.c_generate_neighbors(X, y, n_neighbors=3, prefix='toomany')
+
+
+def test_compress_int8_roundtrip():
+    from emlearn import neighbors
+
+    rng = numpy.random.RandomState(2)
+    X = numpy.column_stack([
+        rng.randint(-20000, 20000, size=200),
+        rng.randint(-50, 50, size=200),
+        rng.randint(1000, 1010, size=200),
+        numpy.full(200, 7),
+    ])
+    codes, offsets, shifts, reconstructed = neighbors.compress_int8(X)
+    assert codes.dtype == numpy.int8
+    assert reconstructed.min() >= -32768 and reconstructed.max() <= 32767
+
+    # error is at most half a quantization step
+    step = 2**shifts.astype(int)
+    assert numpy.all(numpy.abs(reconstructed - X) <= step / 2)
+    assert_equal(reconstructed[:, 1:], X[:, 1:])
+
+
+@pytest.mark.parametrize('algorithm', ['brute', 'kd_tree'])
+def test_classifier_compressed(algorithm):
+    from emlearn import neighbors
+
+    X_train, X_test, y_train, y_test = make_classification_dataset(n_features=8, n_classes=3)
+    model = KNeighborsClassifier(n_neighbors=3, algorithm=algorithm, leaf_size=3).fit(X_train, y_train)
+
+    # Compressed model should give the same as exact search on the reconstructed data
+    _, _, _, reconstructed = neighbors.compress_int8(X_train)
+    reference = KNeighborsClassifier(n_neighbors=3, algorithm='brute').fit(reconstructed, y_train)
+
+    cmodel = emlearn.convert(model, method='loadable', compression='int8')
+    assert_equal(cmodel.predict(X_test), reference.predict(X_test))
+
+    report = neighbors.compression_report(X_train, X_test, n_neighbors=3, benchmark=False)
+    assert report['compression_ratio'] > 1.5
+    assert report['recall'] > 0.8
@@ -1,5 +1,6 @@
 
 #define EML_NET_LOG_LEVEL 1
+#define EML_NET_PROFILE 1
 #include <eml_net.h>
 
 #include <unity.h>
@@ -23,8 +24,8 @@ test_net_logreg_binary()
     const float layer2_weigths[] = { 1.0f };
     const float layer2_biases[] = { 0.0f };
     const EmlNetLayer layers[] = {
-        { 1, 1, layer1_weigths, layer1_biases, EmlNetActivationIdentity },
-        { 1, 1, layer2_weigths, layer2_biases, EmlNetActivationLogistic }
+        { 1, 1, layer1_weigths, layer1_biases, EmlNetActivationIdentity, EmlNetWeightFloat32, NULL },
+        { 1, 1, layer2_weigths, layer2_biases, EmlNetActivationLogistic, EmlNetWeightFloat32, NULL }
     };
 
     // Test data
@@ -46,9 +47,156 @@ test_net_logreg_binary()
     TEST_ASSERT_EQUAL(1, out_label);
 }
 
+void
+test_net_half_conversion()
+{
+    // float16 bit patterns, including a subnormal and negative values
+    const uint16_t f16[] = { 0x0000, 0x3C00, 0xC000, 0x3555, 0x7BFF, 0x0001 };
+    const float f16_expect[] = { 0.0f, 1.0f, -2.0f, 0.333251953125f, 65504.0f, 5.9604644775390625e-08f };
+    for (int i=0; i<6; i++) {
+        TEST_ASSERT_EQUAL_FLOAT(f16_expect[i], eml_net_float16_to_float(f16[i]));
+    }
+    TEST_ASSERT_TRUE(isinf(eml_net_float16_to_float(0x7C00)));
+
+    const uint16_t bf16[] = { 0x0000, 0x3F80, 0xC000, 0x3EAB };
+    const float bf16_expect[] = { 0.0f, 1.0f, -2.0f, 0.333984375f };
+    for (int i=0; i<4; i++) {
+        TEST_ASSERT_EQUAL_FLOAT(bf16_expect[i], eml_net_bfloat16_to_float(bf16[i]));
+    }
+}
+
+#define TEST_NET_COMPACT_INPUTS 2
+#define TEST_NET_COMPACT_OUTPUTS 9
+
+void
+test_net_forward_compact()
+{
+    // Compact weights should give the same output as float,
+    // when the values are exactly representable
+    const float in[TEST_NET_COMPACT_INPUTS] = { 0.5f, -1.0f };
+    const float biases[TEST_NET_COMPACT_OUTPUTS] = { 0.0f, 0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f };
+    const float weights[TEST_NET_COMPACT_INPUTS*TEST_NET_COMPACT_OUTPUTS] = {
+        0.5f, -1.0f, 2.0f, 0.25f, -0.75f, 1.5f, 0.0f, -2.0f, 1.0f,
+        -0.5f, 0.75f, 1.25f, -1.5f, 0.125f, -0.25f, 3.0f, -3.0f, 0.5f
+    };
+    const uint16_t weights_f16[TEST_NET_COMPACT_INPUTS*TEST_NET_COMPACT_OUTPUTS] = {
+        0x3800, 0xBC00, 0x4000, 0x3400, 0xBA00, 0x3E00, 0x0000, 0xC000, 0x3C00,
+        0xB800, 0x3A00, 0x3D00, 0xBE00, 0x3000, 0xB400, 0x4200, 0xC200, 0x3800
+    };
+    const uint16_t weights_bf16[TEST_NET_COMPACT_INPUTS*TEST_NET_COMPACT_OUTPUTS] = {
+        0x3F00, 0xBF80, 0x4000, 0x3E80, 0xBF40, 0x3FC0, 0x0000, 0xC000, 0x3F80,
+        0xBF00, 0x3F40, 0x3FA0, 0xBFC0, 0x3E00, 0xBE80, 0x4040, 0xC040, 0x3F00
+    };
+
+    float out_ref[TEST_NET_COMPACT_OUTPUTS];
+    float out_f16[TEST_NET_COMPACT_OUTPUTS];
+    float out_bf16[TEST_NET_COMPACT_OUTPUTS];
+    EmlError err = EmlOk;
+
+    err = eml_net_forward(in, TEST_NET_COMPACT_INPUTS, weights, biases,
+            EmlNetActivationRelu, out_ref, TEST_NET_COMPACT_OUTPUTS);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    err = eml_net_forward_compact(in, TEST_NET_COMPACT_INPUTS, weights_f16, EmlNetWeightFloat16,
+            biases, EmlNetActivationRelu, out_f16, TEST_NET_COMPACT_OUTPUTS);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    err = eml_net_forward_compact(in, TEST_NET_COMPACT_INPUTS, weights_bf16, EmlNetWeightBFloat16,
+            biases, EmlNetActivationRelu, out_bf16, TEST_NET_COMPACT_OUTPUTS);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+
+    for (int o=0; o<TEST_NET_COMPACT_OUTPUTS; o++) {
+        TEST_ASSERT_FLOAT_WITHIN(1e-6, out_ref[o], out_f16[o]);
+        TEST_ASSERT_FLOAT_WITHIN(1e-6, out_ref[o], out_bf16[o]);
+    }
+}
+
+void
+test_net_context_shared_model()
+{
+    // Same model used with separate contexts, without any buffers in the model itself
+    const float layer1_weights[] = { 1.0f, -1.0f };
+    const float layer1_biases[] = { 0.0f, 0.0f };
+    const float layer2_weights[] = { 2.0f, 1.0f, 0.0f, -1.0f, 1.0f, 0.0f };
+    const float layer2_biases[] = { 0.0f, 0.0f, 0.0f };
+    const EmlNetLayer layers[] = {
+        { 2, 1, layer1_weights, layer1_biases, EmlNetActivationRelu, EmlNetWeightFloat32, NULL },
+        { 3, 2, layer2_weights, layer2_biases, EmlNetActivationSoftmax, EmlNetWeightFloat32, NULL }
+    };
+    const EmlNet model = { 2, layers, NULL, NULL, 0 };
+    TEST_ASSERT_EQUAL(3, eml_net_context_length(&model));
+
+    float a1[TEST_BUFFER_LENGTH];
+    float a2[TEST_BUFFER_LENGTH];
+    float b1[TEST_BUFFER_LENGTH];
+    float b2[TEST_BUFFER_LENGTH];
+    EmlNetContext ctx_a = { a1, a2, TEST_BUFFER_LENGTH, NULL, 0 };
+    EmlNetContext ctx_b = { b1, b2, TEST_BUFFER_LENGTH, NULL, 0 };
+
+    const float positive[] = { 1.0f };
+    const float negative[] = { -1.0f };
+    TEST_ASSERT_EQUAL(0, eml_net_context_predict(&model, &ctx_a, positive, 1));
+    TEST_ASSERT_EQUAL(1, eml_net_context_predict(&model, &ctx_b, negative, 1));
+
+    // Results stay in their own context
+    float proba_a[3];
+    float proba_b[3];
+    EmlError err = eml_net_context_predict_proba(&model, &ctx_a, positive, 1, proba_a, 3);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    err = eml_net_context_predict_proba(&model, &ctx_b, negative, 1, proba_b, 3);
+    TEST_ASSERT_EQUAL(EmlOk, err);
+    TEST_ASSERT_TRUE(proba_a[0] > proba_a[1]);
+    TEST_ASSERT_TRUE(proba_b[1] > proba_b[0]);
+    TEST_ASSERT_EQUAL_FLOAT(proba_a[0], a2[0]);
+    TEST_ASSERT_EQUAL_FLOAT(proba_b[0], b2[0]);
+
+    // Too small context is rejected
+    EmlNetContext small = { a1, a2, 1, NULL, 0 };
+    TEST_ASSERT_EQUAL(-EmlSizeMismatch, eml_net_context_predict(&model, &small, positive, 1));
+}
+
+void
+test_net_profile_counters()
+{
+    const float layer1_weights[] = { 1.0f, -1.0f };
+    const float layer1_biases[] = { 0.0f, 0.0f };
+    const uint16_t layer2_weights[] = { 0x3C00, 0xBC00 }; // float16 1.0, -1.0
+    const float layer2_biases[] = { 0.0f };
+    const EmlNetLayer layers[] = {
+        { 2, 1, layer1_weights, layer1_biases, EmlNetActivationRelu, EmlNetWeightFloat32, NULL },
+        { 1, 2, NULL, layer2_biases, EmlNetActivationLogistic, EmlNetWeightFloat16, layer2_weights }
+    };
+    const EmlNet model = { 2, layers, NULL, NULL, 0 };
+
+    float buffer1[TEST_BUFFER_LENGTH];
+    float buffer2[TEST_BUFFER_LENGTH];
+    EmlNetLayerStats stats[2];
+    eml_net_layer_stats_reset(stats, 2);
+    EmlNetContext ctx = { buffer1, buffer2, TEST_BUFFER_LENGTH, stats, 2 };
+
+    const float features[] = { 0.5f };
+    const int repetitions = 3;
+    for (int i=0; i<repetitions; i++) {
+        TEST_ASSERT_EQUAL(1, eml_net_context_predict(&model, &ctx, features, 1));
+    }
+
+    TEST_ASSERT_EQUAL(repetitions, stats[0].calls);
+    TEST_ASSERT_EQUAL(repetitions*2, stats[0].macs);
+    TEST_ASSERT_EQUAL(repetitions*(2*4 + 2*4), stats[0].weight_bytes);
+    TEST_ASSERT_EQUAL(repetitions*(1+2)*4, stats[0].activation_bytes);
+
+    TEST_ASSERT_EQUAL(repetitions, stats[1].calls);
+    TEST_ASSERT_EQUAL(repetitions*2, stats[1].macs);
+    TEST_ASSERT_EQUAL(repetitions*(2*2 + 1*4), stats[1].weight_bytes);
+    TEST_ASSERT_EQUAL(repetitions*(2+1)*4, stats[1].activation_bytes);
+    TEST_ASSERT_TRUE(stats[1].time_us >= 0);
+}
+
 void
 test_eml_net()
 {
     // Add tests here
     RUN_TEST(test_net_logreg_binary);
+    RUN_TEST(test_net_half_conversion);
+    RUN_TEST(test_net_forward_compact);
+    RUN_TEST(test_net_context_shared_model);
+    RUN_TEST(test_net_profile_counters);
 }
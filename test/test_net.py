@@ -75,6 +75,93 @@ def test_sklearn_predict(modelparams,params):
         assert_equivalent_sklearn(model, X_test, params['classes'], method='loadable')
         assert_almost_equal(proba, cproba, decimal=6)
 
+@pytest.mark.parametrize('weights_dtype', ['float16', 'bfloat16'])
+def test_sklearn_predict_half_weights(weights_dtype):
+
+    rng = numpy.random.RandomState(0)
+    X, y = make_classification(n_features=5, n_classes=3,
+                               n_redundant=0, n_informative=5,
+                               random_state=rng, n_clusters_per_class=1, n_samples=100)
+    X = StandardScaler().fit_transform(X)
+
+    model = MLPClassifier(hidden_layer_sizes=(20,10), max_iter=100, random_state=1)
+    with warnings.catch_warnings():
+        warnings.simplefilter("ignore")
+        model.fit(X, y)
+
+    X_test = X[:10]
+    proba = model.predict_proba(X_test)
+    for method in ['loadable', 'inline']:
+        cmodel = emlearn.convert(model, method=method, weights_dtype=weights_dtype)
+        code = cmodel.save(name='halfnet')
+        assert 'uint16_t halfnet_layer_0_weights' in code
+
+        assert_equal(cmodel.predict(X_test), model.predict(X_test))
+
+    cmodel = emlearn.convert(model, method='loadable', weights_dtype=weights_dtype)
+    cproba = cmodel.predict_proba(X_test)
+    assert_almost_equal(proba, cproba, decimal=2)
+
+def test_sklearn_pipeline_scalers_folded():
+    from sklearn.pipeline import make_pipeline
+    from sklearn.preprocessing import MinMaxScaler
+
+    rng = numpy.random.RandomState(0)
+    X, y = make_classification(n_features=5, n_classes=3,
+                               n_redundant=0, n_informative=5,
+                               random_state=rng, n_clusters_per_class=1, n_samples=100)
+    X = (X * [ 1.0, 10.0, 100.0, 0.1, 3.0 ]) + 50.0
+
+    mlp = MLPClassifier(hidden_layer_sizes=(10,), max_iter=100, random_state=1)
+    model = make_pipeline(MinMaxScaler(), StandardScaler(), mlp)
+    with warnings.catch_warnings():
+        warnings.simplefilter("ignore")
+        model.fit(X, y)
+
+    X_test = X[:20]
+    for method in ['loadable', 'inline']:
+        cmodel = emlearn.convert(model, method=method)
+        # scalers become part of the first layer
+        assert len(cmodel.weights) == len(mlp.coefs_)
+        assert_equal(cmodel.predict(X_test), model.predict(X_test))
+
+    cmodel = emlearn.convert(model, method='loadable')
+    assert_almost_equal(cmodel.predict_proba(X_test), model.predict_proba(X_test), decimal=4)
+
+@pytest.mark.parametrize('with_mean,with_std', [(True, True), (False, True), (True, False), (False, False)])
+def test_sklearn_standard_scaler_affine(with_mean, with_std):
+    from emlearn.net import from_sklearn_scaler
+
+    rng = numpy.random.RandomState(0)
+    X = (rng.normal(size=(50, 4)) * [ 1.0, 10.0, 0.1, 3.0 ]) + 5.0
+    scaler = StandardScaler(with_mean=with_mean, with_std=with_std).fit(X)
+
+    scale, offset = from_sklearn_scaler(scaler)
+    assert_almost_equal(X * scale + offset, scaler.transform(X))
+
+@pytest.mark.parametrize('register_block', [1, 3, 8])
+def test_sklearn_predict_inline_unrolled(register_block):
+
+    rng = numpy.random.RandomState(0)
+    X, y = make_classification(n_features=7, n_classes=4,
+                               n_redundant=0, n_informative=7,
+                               random_state=rng, n_clusters_per_class=1, n_samples=100)
+    X = StandardScaler().fit_transform(X)
+
+    model = MLPClassifier(hidden_layer_sizes=(13,5), activation='tanh', max_iter=100, random_state=1)
+    with warnings.catch_warnings():
+        warnings.simplefilter("ignore")
+        model.fit(X, y)
+
+    cmodel = emlearn.convert(model, method='inline', register_block=register_block)
+    code = cmodel.save(name='unrollnet', inference=['inline'])
+    for layer_no in range(3):
+        assert f'unrollnet_layer_{layer_no}_forward(' in code
+    assert 'eml_net_tanh(acc0 + biases[0])' in code
+
+    X_test = X[:20]
+    assert_equal(cmodel.predict(X_test), model.predict(X_test))
+
 @pytest.mark.xfail()
 @pytest.mark.parametrize('modelparams,params', SKLEARN_PARAMS)
 def test_sklearn_predict_fixedpoint(modelparams,params):
@@ -164,6 +251,21 @@ def keras_dropout_relu_softmax(features, classes):
                   metrics=['accuracy'])
     return model, dict(features=features, classes=classes)
 
+def keras_batchnorm_rescaling(features, classes):
+    # Normalization layers are folded into the Dense weights when converting
+    model = Sequential([
+        keras.layers.Rescaling(0.5, offset=0.1, input_shape=(features,)),
+        Dense(8),
+        keras.layers.BatchNormalization(),
+        Activation('relu'),
+        keras.layers.BatchNormalization(),
+        Dense(classes, activation='softmax'),
+    ])
+    model.compile(optimizer='rmsprop',
+                  loss='categorical_crossentropy',
+                  metrics=['accuracy'])
+    return model, dict(features=features, classes=classes)
+
 # TODO: support CNNs. Conv1D/2D, (ZeroPadding1D/2D), Average/MaxPooling1D/2D, Flatten
 # TODO: support simple functional Models, like Logistic Regression. Input+Dense+Softmax
 
@@ -179,6 +281,9 @@ KERAS_REGRESSION_MODELS = {
 if getattr(keras.layers, 'ReLu', None):
     KERAS_MODELS['Dropout.Relu.Softmax'] = keras_dropout_relu_softmax(3, 4),
 
+if getattr(keras.layers, 'Rescaling', None):
+    KERAS_MODELS['BatchNorm.Rescaling'] = keras_batchnorm_rescaling(3, 4)
+
 def assert_equivalent(model, X_test, n_classes, method):
     cmodel = emlearn.convert(model, method=method)
 